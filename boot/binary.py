@@ -10,7 +10,7 @@ class Binary:
             except ValueError:
                 pass
         self.regions = []
-        for line in os.popen("readelf -l %s"%self.name).readlines():
+        for line in os.popen("readelf -lW %s"%self.name).readlines():
             line = line[:-1].strip()
             if line.startswith("LOAD"):
                 self.regions.append(map(lambda x: int(x, 0), line.split()[1:6]))
@@ -35,3 +35,15 @@ class Binary:
             fw.write(phys, f.read(fsize))
             fw.write(phys + fsize, "\x00"*(msize - fsize))
         return self.entry_point
+    def place(self, fw):
+        "write the file part of each segment, return the entry point and the segments"
+        f = open(self.name)
+        segments = []
+        for ofs,virt,phys,fsize,msize in self.regions:
+            f.seek(ofs)
+            fw.write(phys, f.read(fsize))
+            segments.append((phys, fsize, msize))
+        return self.entry_point, segments
+    def top(self):
+        "the physical end of the highest segment"
+        return max([phys + msize for ofs,virt,phys,fsize,msize in self.regions])
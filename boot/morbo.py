@@ -3,11 +3,37 @@
 
 # TODO Support for more than two devices on the bus.
 
-import os, sys, struct, firewire, string, config, getopt, time, re
+import os, sys, struct, firewire, binary, string, config, getopt, time, re
 from socket import ntohl
 
 CROM_ADDR = 0xfffff0000400
 
+# Descriptor of a kernel whose segments we wrote ourselves. See
+# struct placed_image in standalone/include/elf.h.
+PLACED_MAGIC = 0x4C504D4D
+
+# Morbo's trampolines live here. They are written right before the
+# kernel starts.
+TRAMPOLINES = (0x7000, 0x8C00)
+
+def place_kernel(path, fw, busy):
+    """Write the segments of an ELF kernel to their physical addresses
+    and return the descriptor module that tells Morbo to only clear
+    BSS and jump. Also returns the end of the highest segment. Returns
+    None, if a segment would overwrite one of the busy ranges."""
+    b = binary.Binary(path)
+    for ofs, virt, phys, fsize, msize in b.regions:
+	for start, end in busy:
+	    if phys < end and start < phys + msize:
+		print "segment %#x-%#x overlaps Morbo at %#x-%#x, pushing it as module" % \
+		    (phys, phys + msize, start, end)
+		return None
+    entry, segments = b.place(fw)
+    desc = struct.pack("<III", PLACED_MAGIC, entry, len(segments))
+    for addr, fsize, msize in segments:
+	desc += struct.pack("<III", addr, fsize, msize)
+    return desc, b.top()
+
 def read_pulsar_config(name, state):
     """Handle pulsar config files. This is not 100% compatible, as we
     handle "exec" the same as "load" and let morbo do the job of ELF
@@ -50,12 +76,32 @@ def is_morbo(fw=firewire.RemoteFw()):
     else:
 	return (False, 0, 0, 0)
 
-def boot(files, fw=firewire.RemoteFw()):
+def read_doorbell(fw):
+    """Returns the interrupt vector that wakes Morbo up, or 0 if it
+    does not want one. Older versions have no doorbell in their
+    ConfigROM leaf."""
+    leaf = ntohl(struct.unpack("I", fw.read(CROM_ADDR + 17*4, 4))[0])
+    if (leaf >> 16) < 2:
+	return 0
+    return ntohl(struct.unpack("I", fw.read(CROM_ADDR + 19*4, 4))[0]) & 0xFF
+
+def read_loader(fw):
+    """Returns where Morbo itself lives as (start, end) or None, if it
+    is too old to tell us."""
+    leaf = ntohl(struct.unpack("I", fw.read(CROM_ADDR + 17*4, 4))[0])
+    if (leaf >> 16) < 4:
+	return None
+    return (ntohl(struct.unpack("I", fw.read(CROM_ADDR + 20*4, 4))[0]),
+	    ntohl(struct.unpack("I", fw.read(CROM_ADDR + 21*4, 4))[0]))
+
+def boot(files, fw=firewire.RemoteFw(), place=False):
     loadaddr = 0x01000000
 
     ready, vendor, model, remote_mbi = is_morbo(fw)
     assert(ready)
     print("MBI: %#x" % remote_mbi)
+    doorbell = read_doorbell(fw)
+    loader = read_loader(fw)
 
 
     # Check if the node is ready to receive something (no modules in
@@ -80,6 +126,17 @@ def boot(files, fw=firewire.RemoteFw()):
 	    name = item[0]
 	    print "    mod[%02d] %s [%08x -"%(len(mods), string.ljust(name, 50), loadaddr),
 	    data = open(item[1]).read()
+	    if place and not mods and data.startswith("\x7fELF"):
+		# We can only keep clear of Morbo, if we know where it
+		# is. Otherwise Morbo unpacks the kernel itself.
+		placed = None
+		if loader:
+		    busy = [loader, TRAMPOLINES, (remote_mbi, remote_mbi + 0x5000)]
+		    placed = place_kernel(item[1], fw, busy)
+		if placed:
+		    # Segments may go where we would put modules. Skip them.
+		    data, top = placed
+		    loadaddr = max(loadaddr, (top + 0xfff) & ~0xfff)
 	    fw.write(loadaddr, data)
 	    mods.append((loadaddr, loadaddr + len(data), item[0]))
 	    loadaddr += len(data)
@@ -107,23 +164,30 @@ def boot(files, fw=firewire.RemoteFw()):
     # Morbo waits for the module count to change. Update it after the
     # rest of the multiboot info is written.
     fw.write(remote_mbi + 5*4, struct.pack("I", len(mods)))
+    # Morbo may sleep waiting for an interrupt. Ring its doorbell, if
+    # it has one.
+    if doorbell:
+	fw.send_extint(doorbell)
     if (len(mods) == 1):
 	print("XXX Only one module loaded! We might try to DMA to a running node...");
 
 if __name__ == "__main__":
     try:
-	opts, args = getopt.getopt(sys.argv[1:], "", ["once"])
+	opts, args = getopt.getopt(sys.argv[1:], "", ["once", "place"])
 	opts = set([ a for (a, b) in opts ]) # Strip parameter
 	if not (opts & set(["--once"])):
 	    print("Waiting for a Morbo node...")
 	    while not is_morbo()[0]:
 		time.sleep(1)
-	boot([args[0]])
+	boot([args[0]], place = "--place" in opts)
     except getopt.GetoptError, err:
 	# print help information and exit:
 	print(str(err)) # will print something like "option -a not recognized"
 	print("Options:")
 	print("  --once    Don't wait for a node to come up.")
+	print("  --place   Write the kernel's segments to where they belong.")
+	print("            Morbo only clears BSS then. Falls back to a normal")
+	print("            module, if they would overlap Morbo.")
 	sys.exit(2)
     except KeyboardInterrupt, err:
 	print("Interrupted.");
@@ -69,6 +69,7 @@ typedef struct memory_map
 
 enum memory_map_type {
   MMAP_AVAILABLE = 1,
+  MMAP_PCI_TABLE = 0x54494350,  /* Reserved, holds struct pci_table */
 };
 
 /* EOF */
@@ -36,17 +36,31 @@
  * Copyright (C) 1995-1998 Jean-loup Gailly and Mark Adler
  */
 
+/*
+ * SSSE3 version added for Morbo, it follows the weighted-sum
+ * technique of Chromium's zlib (adler32_simd.c).
+ */
+
 #include "tinf.h"
 
 #define A32_BASE 65521
 #define A32_NMAX 5552
 
-unsigned int tinf_adler32(const void *data, unsigned int length)
-{
-   const unsigned char *buf = (const unsigned char *)data;
+typedef char TINF_V16QI __attribute__((vector_size(16)));
+typedef short TINF_V8HI __attribute__((vector_size(16)));
+typedef int TINF_V4SI __attribute__((vector_size(16)));
+typedef long long TINF_V2DI __attribute__((vector_size(16)));
+typedef char TINF_UNALIGNED_V16QI __attribute__((vector_size(16), may_alias, aligned(1)));
 
-   unsigned int s1 = 1;
-   unsigned int s2 = 0;
+static unsigned int (*tinf_adler32_fn)(unsigned int adler, const unsigned char *buf,
+                                       unsigned int length);
+
+/* update adler with length bytes, the plain zlib loop */
+static unsigned int tinf_adler32_scalar(unsigned int adler, const unsigned char *buf,
+                                        unsigned int length)
+{
+   unsigned int s1 = adler & 0xffff;
+   unsigned int s2 = adler >> 16;
 
    while (length > 0)
    {
@@ -76,3 +90,83 @@ unsigned int tinf_adler32(const void *data, unsigned int length)
 
    return (s2 << 16) | s1;
 }
+
+/* update adler with 32 bytes per iteration, needs SSSE3 for
+ * pmaddubsw */
+__attribute__((target("ssse3")))
+static unsigned int tinf_adler32_ssse3(unsigned int adler, const unsigned char *buf,
+                                       unsigned int length)
+{
+   /* weights of the bytes in a 32 byte block for s2 */
+   const TINF_V16QI tap1 = { 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17 };
+   const TINF_V16QI tap2 = { 16, 15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1 };
+   const TINF_V16QI zero = { 0 };
+   const TINF_V8HI ones = { 1, 1, 1, 1, 1, 1, 1, 1 };
+   unsigned int s1 = adler & 0xffff;
+   unsigned int s2 = adler >> 16;
+   unsigned int blocks = length / 32;
+
+   length -= blocks * 32;
+
+   while (blocks)
+   {
+      /* as many blocks as we can sum up without overflow */
+      unsigned int n = blocks < A32_NMAX / 32 ? blocks : A32_NMAX / 32;
+      TINF_V4SI v_ps = { (int)(s1 * n), 0, 0, 0 };
+      TINF_V4SI v_s2 = { (int)s2, 0, 0, 0 };
+      TINF_V4SI v_s1 = { 0 };
+
+      blocks -= n;
+
+      do {
+         TINF_V16QI bytes1 = ((const TINF_UNALIGNED_V16QI *)buf)[0];
+         TINF_V16QI bytes2 = ((const TINF_UNALIGNED_V16QI *)buf)[1];
+
+         /* s1 of all previous blocks is added 32 times to s2 */
+         v_ps += v_s1;
+
+         /* horizontal byte sums for s1 */
+         v_s1 += (TINF_V4SI)__builtin_ia32_psadbw128(bytes1, zero);
+         v_s1 += (TINF_V4SI)__builtin_ia32_psadbw128(bytes2, zero);
+
+         /* weighted byte sums for s2 */
+         v_s2 += __builtin_ia32_pmaddwd128(__builtin_ia32_pmaddubsw128(bytes1, tap1), ones);
+         v_s2 += __builtin_ia32_pmaddwd128(__builtin_ia32_pmaddubsw128(bytes2, tap2), ones);
+
+         buf += 32;
+      } while (--n);
+
+      v_s2 += v_ps << 5;
+
+      s1 += (unsigned int)v_s1[0] + v_s1[1] + v_s1[2] + v_s1[3];
+      s2  = (unsigned int)v_s2[0] + v_s2[1] + v_s2[2] + v_s2[3];
+
+      s1 %= A32_BASE;
+      s2 %= A32_BASE;
+   }
+
+   return tinf_adler32_scalar((s2 << 16) | s1, buf, length);
+}
+
+/* check CPUID for SSSE3, SSE must already be enabled in CR4 */
+static int tinf_has_ssse3(void)
+{
+   unsigned int eax = 1, ebx, ecx, edx;
+
+   __asm__ ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+   return (ecx & (1 << 9)) != 0;
+}
+
+unsigned int tinf_adler32_update(unsigned int adler, const void *data, unsigned int length)
+{
+   if (!tinf_adler32_fn)
+      tinf_adler32_fn = tinf_has_ssse3() ? tinf_adler32_ssse3 : tinf_adler32_scalar;
+
+   return tinf_adler32_fn(adler, (const unsigned char *)data, length);
+}
+
+unsigned int tinf_adler32(const void *data, unsigned int length)
+{
+   return tinf_adler32_update(1, data, length);
+}
@@ -6,6 +6,7 @@
 #include <version.h>
 #include <serial.h>
 #include <mbi-tools.h>
+#include <memops.h>
 
 static void
 t_empty(void)
@@ -45,6 +46,27 @@ t_rdmsr(void)
   asm volatile ("rdmsr" : "=a"(eax), "=d"(edx) : "c"(0xfe)); 
 }
 
+/* Config space of 00:00.0 through either backend. */
+static void
+t_pcicfg(void)
+{
+  pci_port_read_uint32(0x80000000 | PCI_CFG_VENDOR_ID);
+}
+
+static bool has_ecam;
+
+static bool
+ecam_usable(void)
+{
+  return has_ecam;
+}
+
+static void
+t_pciecam(void)
+{
+  pci_ecam_read_uint32(0x80000000 | PCI_CFG_VENDOR_ID);
+}
+
 static void
 t_fmmio(void)
 {
@@ -54,6 +76,7 @@ t_fmmio(void)
 struct test {
   const char *name;
   void (*test_fn)(void);
+  bool (*usable)(void);         /* NULL if always */
 };
 
 static const struct test tests[] = {
@@ -63,10 +86,69 @@ static const struct test tests[] = {
   { "portio", t_portio },
   { "mmio  ", t_mmio },
   { "rdmsr ", t_rdmsr },
+  { "pcicfg", t_pcicfg },
+  { "ecam  ", t_pciecam, ecam_usable },
   /* Doesn't work. :) */
   //{ "fmmio ", t_fmmio },
 };
 
+enum {
+  SWEEP_MIN  = 16,
+  SWEEP_MAX  = 16 << 20,
+  SWEEP_RUNS = 8,
+};
+
+/**
+ * Time all memcpy() and memset() variants this CPU can run for sizes
+ * from SWEEP_MIN to SWEEP_MAX. This shows where one variant overtakes
+ * another, which memops.h needs to know.
+ */
+static void
+mem_sweep(struct mbi *mbi)
+{
+  void *block;
+  size_t block_len;
+
+  if (!(mbi->flags & MBI_FLAG_MMAP) ||
+      !mbi_find_memory(mbi, 2 * SWEEP_MAX, &block, &block_len, true)) {
+    printf("No memory for the memcpy sweep.\n");
+    return;
+  }
+
+  char *dst = (char *)block + block_len - 2 * SWEEP_MAX;
+  char *src = dst + SWEEP_MAX;
+  unsigned features = mem_features();
+
+  memset(src, 0x5A, SWEEP_MAX);
+
+  for (size_t size = SWEEP_MIN; size <= SWEEP_MAX; size *= 4) {
+    for (unsigned v = 0; v < mem_variant_count; v++) {
+      const struct mem_variant *var = &mem_variants[v];
+      uint32_t copy = ~0U, set = ~0U;
+
+      if ((var->needs & features) != var->needs)
+        continue;
+
+      /* The best run, so small sizes are measured with a warm cache. */
+      for (unsigned r = 0; r < SWEEP_RUNS; r++) {
+        uint64_t start = rdtsc();
+        var->copy(dst, src, size);
+        uint64_t mid = rdtsc();
+        var->set(dst, 0, size);
+        uint64_t end = rdtsc();
+
+        copy = MIN(copy, (uint32_t)(mid - start));
+        set  = MIN(set,  (uint32_t)(end - mid));
+      }
+
+      printf("! PERF: memcpy %s %8u bytes %u cycles (%u ns) ok\n", var->name, size, copy,
+             (uint32_t)cycles_to_ns(copy));
+      printf("! PERF: memset %s %8u bytes %u cycles (%u ns) ok\n", var->name, size, set,
+             (uint32_t)cycles_to_ns(set));
+    }
+  }
+}
+
 static float sqrtf(float v)
 {
   asm ("fsqrt" : "+t" (v));
@@ -86,6 +168,11 @@ main(uint32_t magic, struct mbi *mbi)
   printf("\nbasicperf %s\n", version_str);
   printf("Blame Julian Stecklina <jsteckli@os.inf.tu-dresden.de> for bugs.\n\n");
 
+  has_ecam = pci_ecam_init();
+
+  clock_init();
+  printf("TSC: %u kHz (source: %s)\n", clock_tsc_khz(), clock_source());
+
   printf("Testing \"Basic VM performance\" in %s:\n", __FILE__);
 
   static const unsigned max_stddev = 1000;
@@ -97,6 +184,11 @@ main(uint32_t magic, struct mbi *mbi)
     unsigned retries = 0;
     uint64_t start, end;
 
+    if (tests[i].usable && !tests[i].usable()) {
+      printf("Skipping %s.\n", tests[i].name);
+      continue;
+    }
+
   again:
     /* Do a warmup round and then the real measurement. */
     for (unsigned w = 0; w < 2; w++)
@@ -130,9 +222,12 @@ main(uint32_t magic, struct mbi *mbi)
       goto again;
     }
 
-    printf("! PERF: %s %u cycles (retries=%u stddev=%u min=%u max=%u) ok\n",
-           tests[i].name, (uint32_t)mean, retries, (uint32_t)stddev, min, max);
+    printf("! PERF: %s %u cycles (%u ns retries=%u stddev=%u min=%u max=%u) ok\n",
+           tests[i].name, (uint32_t)mean, (uint32_t)cycles_to_ns(mean), retries,
+           (uint32_t)stddev, min, max);
   }
+  mem_sweep(mbi);
+
   printf("wvtest: done\n");
 
   return 0;
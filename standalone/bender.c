@@ -48,6 +48,8 @@ main(uint32_t magic, struct mbi *mbi)
   printf("\nBender %s\n", version_str);
   printf("Blame Julian Stecklina <jsteckli@os.inf.tu-dresden.de> for bugs.\n\n");
 
+  pci_init(mbi);
+
   printf("Looking for serial controllers on the PCI bus...\n");
 
   struct pci_device serial_ctrl;
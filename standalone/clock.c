@@ -0,0 +1,204 @@
+/* -*- Mode: C -*- */
+/*
+ * Time keeping with the TSC.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+/* We count TSC cycles and convert. Reading the TSC is much cheaper
+   than reading the PIT through port I/O, so short waits and
+   deadline checks stay short. The TSC is assumed to run at a
+   constant rate while we are around. */
+
+#include <stdint.h>
+#include <acpi.h>
+#include <util.h>
+#include <clock.h>
+
+enum {
+  CALIBRATE_MS     = 10,
+
+  /* Give up on a timer that does not tick, before this many
+     cycles. This is 10ms on a 100 GHz machine. */
+  CALIBRATE_LIMIT  = 1000000000,
+
+  PIT_HZ           = 1193182,
+  PIT_CH2_DATA     = 0x42,
+  PIT_CMD          = 0x43,
+  PIT_CH2_GATE     = 0x61,
+
+  PIT_GATE_ON      = 1 << 0,
+  PIT_SPEAKER_ON   = 1 << 1,
+  PIT_CH2_OUT      = 1 << 5,
+
+  HPET_PERIOD      = 0x04,	/* Upper half of the capabilities */
+  HPET_CONF        = 0x10,
+  HPET_COUNTER     = 0xF0,
+
+  HPET_ENABLE      = 1 << 0,
+  HPET_MAX_PERIOD  = 100000000, /* fs */
+};
+
+static uint32_t tsc_khz;
+static uint64_t tsc_base;
+static const char *tsc_source = "none";
+
+/* Returns TSC cycles per millisecond or 0, if there is no usable
+   HPET. */
+static uint32_t
+calibrate_hpet(void)
+{
+  struct rsdp *rsdp = acpi_get_rsdp();
+  if (!rsdp)
+    return 0;
+
+  struct acpi_table **ptab = acpi_get_table_ptr((struct acpi_table *)rsdp->rsdt, "HPET");
+  if (!ptab || !*ptab)
+    return 0;
+
+  struct hpet *tab = (struct hpet *)*ptab;
+  if ((tab->address_space != 0) || (tab->address == 0) || (tab->address >> 32))
+    return 0;
+
+  volatile uint32_t *hpet = (volatile uint32_t *)(uintptr_t)tab->address;
+  uint32_t period = hpet[HPET_PERIOD / 4];
+
+  if ((period == 0) || (period > HPET_MAX_PERIOD))
+    return 0;
+
+  /* The counter only runs while the HPET is enabled. Leave it as we
+     found it. */
+  uint32_t conf = hpet[HPET_CONF / 4];
+  hpet[HPET_CONF / 4] = conf | HPET_ENABLE;
+
+  uint32_t ticks = (uint64_t)CALIBRATE_MS * 1000000000000ULL / period;
+  uint32_t start = hpet[HPET_COUNTER / 4];
+  uint32_t now;
+  uint64_t tsc_start = rdtsc();
+  uint64_t tsc_end;
+
+  do {
+    now = hpet[HPET_COUNTER / 4];
+    tsc_end = rdtsc();
+  } while ((now - start < ticks) && (tsc_end - tsc_start < CALIBRATE_LIMIT));
+
+  hpet[HPET_CONF / 4] = conf;
+
+  if (now - start < ticks)
+    return 0;
+
+  uint64_t ns = (uint64_t)(now - start) * period / 1000000;
+  return (tsc_end - tsc_start) * 1000000 / ns;
+}
+
+/* Returns TSC cycles per millisecond or 0, if PIT channel 2 does not
+   count. */
+static uint32_t
+calibrate_pit(void)
+{
+  uint16_t latch = PIT_HZ * CALIBRATE_MS / 1000;
+  uint8_t gate = inb(PIT_CH2_GATE);
+
+  /* Channel 2 counts down once, while its gate is on. Keep the
+     speaker quiet. */
+  outb(PIT_CH2_GATE, (gate & ~PIT_SPEAKER_ON) | PIT_GATE_ON);
+  outb(PIT_CMD, 0xB0);		/* Channel 2, lo/hi byte, mode 0 */
+  outb(PIT_CH2_DATA, latch & 0xFF);
+  outb(PIT_CH2_DATA, latch >> 8);
+
+  uint64_t tsc_start = rdtsc();
+  uint64_t tsc_end;
+  bool done;
+
+  do {
+    done = (inb(PIT_CH2_GATE) & PIT_CH2_OUT) != 0;
+    tsc_end = rdtsc();
+  } while (!done && (tsc_end - tsc_start < CALIBRATE_LIMIT));
+
+  outb(PIT_CH2_GATE, gate);
+
+  return done ? (tsc_end - tsc_start) / CALIBRATE_MS : 0;
+}
+
+void
+clock_init(void)
+{
+  if (tsc_khz)
+    return;
+
+  if ((tsc_khz = calibrate_hpet()) != 0)
+    tsc_source = "HPET";
+  else if ((tsc_khz = calibrate_pit()) != 0)
+    tsc_source = "PIT";
+  else {
+    /* Better too long than not at all. */
+    tsc_khz = 4000000;
+    tsc_source = "guess";
+  }
+
+  tsc_base = rdtsc();
+}
+
+uint32_t
+clock_tsc_khz(void)
+{
+  clock_init();
+  return tsc_khz;
+}
+
+const char *
+clock_source(void)
+{
+  clock_init();
+  return tsc_source;
+}
+
+uint64_t
+cycles_to_ns(uint64_t cycles)
+{
+  return cycles * 1000000 / clock_tsc_khz();
+}
+
+uint64_t
+ns_to_cycles(uint64_t ns)
+{
+  return ns * clock_tsc_khz() / 1000000;
+}
+
+uint64_t
+now_ns(void)
+{
+  clock_init();
+  return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+void
+ndelay(uint32_t ns)
+{
+  struct deadline d = deadline_in_ns(ns);
+
+  while (!deadline_passed(d))
+    asm volatile ("pause");
+}
+
+void
+udelay(uint32_t us)
+{
+  struct deadline d = deadline_in_us(us);
+
+  while (!deadline_passed(d))
+    asm volatile ("pause");
+}
+
+/* EOF */
@@ -0,0 +1,197 @@
+/* -*- Mode: C -*- */
+/*
+ * Module format detection and checksums for the decompressors.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <stddef.h>
+#include <codec.h>
+#include <tinf.h>
+
+static uint32_t
+le32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool
+gzip_probe(const void *source, unsigned int sourceLen)
+{
+  const uint8_t *p = source;
+  return (sourceLen >= 18) && (p[0] == 0x1f) && (p[1] == 0x8b);
+}
+
+static bool
+lz4_probe(const void *source, unsigned int sourceLen)
+{
+  return (sourceLen >= 7) && (le32(source) == 0x184D2204);
+}
+
+static bool
+zstd_probe(const void *source, unsigned int sourceLen)
+{
+  return (sourceLen >= 6) && (le32(source) == 0xFD2FB528);
+}
+
+static const struct codec codecs[] = {
+  { "gzip", gzip_probe, tinf_gzip_uncompress },
+  { "lz4",  lz4_probe,  lz4_uncompress },
+  { "zstd", zstd_probe, zstd_uncompress },
+};
+
+/** Find the codec for compressed data by its magic bytes. */
+const struct codec *
+codec_detect(const void *source, unsigned int sourceLen)
+{
+  for (unsigned i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+    if (codecs[i].probe(source, sourceLen))
+      return &codecs[i];
+
+  return NULL;
+}
+
+/* xxHash, as used for the LZ4 and zstd checksums. */
+
+static const uint32_t XXH32_P1 = 2654435761U;
+static const uint32_t XXH32_P2 = 2246822519U;
+static const uint32_t XXH32_P3 = 3266489917U;
+static const uint32_t XXH32_P4 = 668265263U;
+static const uint32_t XXH32_P5 = 374761393U;
+
+static const uint64_t XXH64_P1 = 11400714785074694791ULL;
+static const uint64_t XXH64_P2 = 14029467366897019727ULL;
+static const uint64_t XXH64_P3 = 1609587929392839161ULL;
+static const uint64_t XXH64_P4 = 9650029242287828579ULL;
+static const uint64_t XXH64_P5 = 2870177450012600261ULL;
+
+static uint32_t rotl32(uint32_t v, unsigned r) { return (v << r) | (v >> (32 - r)); }
+static uint64_t rotl64(uint64_t v, unsigned r) { return (v << r) | (v >> (64 - r)); }
+
+static uint64_t
+le64(const uint8_t *p)
+{
+  return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static uint32_t
+xxh32_round(uint32_t acc, uint32_t input)
+{
+  return rotl32(acc + input * XXH32_P2, 13) * XXH32_P1;
+}
+
+uint32_t
+xxh32(const void *data, unsigned int len, uint32_t seed)
+{
+  const uint8_t *p = data;
+  const uint8_t *end = p + len;
+  uint32_t h;
+
+  if (len >= 16) {
+    uint32_t v1 = seed + XXH32_P1 + XXH32_P2;
+    uint32_t v2 = seed + XXH32_P2;
+    uint32_t v3 = seed;
+    uint32_t v4 = seed - XXH32_P1;
+
+    for (; p + 16 <= end; p += 16) {
+      v1 = xxh32_round(v1, le32(p));
+      v2 = xxh32_round(v2, le32(p + 4));
+      v3 = xxh32_round(v3, le32(p + 8));
+      v4 = xxh32_round(v4, le32(p + 12));
+    }
+
+    h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+  } else
+    h = seed + XXH32_P5;
+
+  h += len;
+
+  for (; p + 4 <= end; p += 4)
+    h = rotl32(h + le32(p) * XXH32_P3, 17) * XXH32_P4;
+
+  for (; p < end; p++)
+    h = rotl32(h + *p * XXH32_P5, 11) * XXH32_P1;
+
+  h ^= h >> 15;
+  h *= XXH32_P2;
+  h ^= h >> 13;
+  h *= XXH32_P3;
+  h ^= h >> 16;
+
+  return h;
+}
+
+static uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+  return rotl64(acc + input * XXH64_P2, 31) * XXH64_P1;
+}
+
+static uint64_t
+xxh64_merge(uint64_t h, uint64_t v)
+{
+  return (h ^ xxh64_round(0, v)) * XXH64_P1 + XXH64_P4;
+}
+
+uint64_t
+xxh64(const void *data, unsigned int len, uint64_t seed)
+{
+  const uint8_t *p = data;
+  const uint8_t *end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + XXH64_P1 + XXH64_P2;
+    uint64_t v2 = seed + XXH64_P2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - XXH64_P1;
+
+    for (; p + 32 <= end; p += 32) {
+      v1 = xxh64_round(v1, le64(p));
+      v2 = xxh64_round(v2, le64(p + 8));
+      v3 = xxh64_round(v3, le64(p + 16));
+      v4 = xxh64_round(v4, le64(p + 24));
+    }
+
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxh64_merge(h, v1);
+    h = xxh64_merge(h, v2);
+    h = xxh64_merge(h, v3);
+    h = xxh64_merge(h, v4);
+  } else
+    h = seed + XXH64_P5;
+
+  h += len;
+
+  for (; p + 8 <= end; p += 8)
+    h = rotl64(h ^ xxh64_round(0, le64(p)), 27) * XXH64_P1 + XXH64_P4;
+
+  if (p + 4 <= end) {
+    h = rotl64(h ^ (uint64_t)le32(p) * XXH64_P1, 23) * XXH64_P2 + XXH64_P3;
+    p += 4;
+  }
+
+  for (; p < end; p++)
+    h = rotl64(h ^ *p * XXH64_P5, 11) * XXH64_P1;
+
+  h ^= h >> 33;
+  h *= XXH64_P2;
+  h ^= h >> 29;
+  h *= XXH64_P3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+/* EOF */
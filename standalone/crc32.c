@@ -36,8 +36,16 @@
  * Copyright (C) 1995-1998 Jean-loup Gailly and Mark Adler
  */
 
+/*
+ * Slice-by-8 and PCLMULQDQ folding added for Morbo. The folding
+ * constants are taken from Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction" white paper.
+ */
+
 #include "tinf.h"
 
+#ifdef TINF_SMALL
+
 static const unsigned int tinf_crc32tab[16] = {
    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190,
    0x6b6b51f4, 0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344,
@@ -45,13 +53,12 @@ static const unsigned int tinf_crc32tab[16] = {
    0xbdbdf21c
 };
 
-unsigned int tinf_crc32(const void *data, unsigned int length)
+unsigned int tinf_crc32_update(unsigned int crc, const void *data, unsigned int length)
 {
    const unsigned char *buf = (const unsigned char *)data;
-   unsigned int crc = 0xffffffff;
    unsigned int i;
 
-   if (length == 0) return 0;
+   crc ^= 0xffffffff;
 
    for (i = 0; i < length; ++i)
    {
@@ -62,3 +69,156 @@ unsigned int tinf_crc32(const void *data, unsigned int length)
 
    return crc ^ 0xffffffff;
 }
+
+#else
+
+typedef unsigned int __attribute__((may_alias, aligned(1))) TINF_UNALIGNED_UINT;
+
+typedef long long TINF_V2DI __attribute__((vector_size(16)));
+typedef int TINF_V4SI __attribute__((vector_size(16)));
+typedef long long TINF_UNALIGNED_V2DI __attribute__((vector_size(16), may_alias, aligned(1)));
+
+/* one table per byte position, built on first use */
+static unsigned int tinf_crc32tab[8][256];
+
+static unsigned int (*tinf_crc32_fn)(unsigned int crc, const unsigned char *buf,
+                                     unsigned int length);
+
+/* update crc with length bytes, eight bytes per iteration */
+static unsigned int tinf_crc32_slice8(unsigned int crc, const unsigned char *buf,
+                                      unsigned int length)
+{
+   for (; length && ((unsigned long)buf & 3); --length)
+      crc = tinf_crc32tab[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+   for (; length >= 8; length -= 8, buf += 8)
+   {
+      unsigned int one = *(const TINF_UNALIGNED_UINT *)buf ^ crc;
+      unsigned int two = *(const TINF_UNALIGNED_UINT *)(buf + 4);
+
+      crc = tinf_crc32tab[7][one & 0xff] ^
+            tinf_crc32tab[6][(one >> 8) & 0xff] ^
+            tinf_crc32tab[5][(one >> 16) & 0xff] ^
+            tinf_crc32tab[4][one >> 24] ^
+            tinf_crc32tab[3][two & 0xff] ^
+            tinf_crc32tab[2][(two >> 8) & 0xff] ^
+            tinf_crc32tab[1][(two >> 16) & 0xff] ^
+            tinf_crc32tab[0][two >> 24];
+   }
+
+   for (; length; --length)
+      crc = tinf_crc32tab[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+   return crc;
+}
+
+#define PCLMUL(a, b, imm) __builtin_ia32_pclmulqdq128((a), (b), (imm))
+#define SHIFT_RIGHT_BYTES(a, n) __builtin_ia32_psrldqi128((a), 8 * (n))
+
+/* update crc by folding 64 bytes per iteration with carry-less
+ * multiplications, needs SSE2 and PCLMULQDQ */
+__attribute__((target("sse2,pclmul")))
+static unsigned int tinf_crc32_pclmul(unsigned int crc, const unsigned char *buf,
+                                      unsigned int length)
+{
+   const TINF_V2DI k1k2 = { 0x0154442bd4LL, 0x01c6e41596LL };
+   const TINF_V2DI k3k4 = { 0x01751997d0LL, 0x00ccaa009eLL };
+   const TINF_V2DI k5k0 = { 0x0163cd6124LL, 0 };
+   const TINF_V2DI poly = { 0x01db710641LL, 0x01f7011641LL };
+   const TINF_V2DI mask = (TINF_V2DI)(TINF_V4SI){ ~0, 0, ~0, 0 };
+   const TINF_UNALIGNED_V2DI *p = (const TINF_UNALIGNED_V2DI *)buf;
+   TINF_V2DI x1, x2, x3, x4;
+   unsigned int tail;
+
+   if (length < 64) return tinf_crc32_slice8(crc, buf, length);
+
+   tail = length & 15;
+   length -= tail;
+
+   x1 = p[0] ^ (TINF_V2DI)(TINF_V4SI){ (int)crc, 0, 0, 0 };
+   x2 = p[1];
+   x3 = p[2];
+   x4 = p[3];
+
+   for (p += 4, length -= 64; length >= 64; p += 4, length -= 64)
+   {
+      x1 = PCLMUL(x1, k1k2, 0x11) ^ PCLMUL(x1, k1k2, 0x00) ^ p[0];
+      x2 = PCLMUL(x2, k1k2, 0x11) ^ PCLMUL(x2, k1k2, 0x00) ^ p[1];
+      x3 = PCLMUL(x3, k1k2, 0x11) ^ PCLMUL(x3, k1k2, 0x00) ^ p[2];
+      x4 = PCLMUL(x4, k1k2, 0x11) ^ PCLMUL(x4, k1k2, 0x00) ^ p[3];
+   }
+
+   /* fold the four lanes into one */
+   x1 = PCLMUL(x1, k3k4, 0x11) ^ PCLMUL(x1, k3k4, 0x00) ^ x2;
+   x1 = PCLMUL(x1, k3k4, 0x11) ^ PCLMUL(x1, k3k4, 0x00) ^ x3;
+   x1 = PCLMUL(x1, k3k4, 0x11) ^ PCLMUL(x1, k3k4, 0x00) ^ x4;
+
+   for (; length >= 16; p++, length -= 16)
+      x1 = PCLMUL(x1, k3k4, 0x11) ^ PCLMUL(x1, k3k4, 0x00) ^ p[0];
+
+   /* fold 128 bits to 64 bits */
+   x2 = PCLMUL(x1, k3k4, 0x10);
+   x1 = SHIFT_RIGHT_BYTES(x1, 8) ^ x2;
+
+   x2 = SHIFT_RIGHT_BYTES(x1, 4);
+   x1 = PCLMUL(x1 & mask, k5k0, 0x00) ^ x2;
+
+   /* Barrett reduction to 32 bits */
+   x2 = PCLMUL(x1 & mask, poly, 0x10);
+   x2 = PCLMUL(x2 & mask, poly, 0x00);
+   x1 ^= x2;
+
+   crc = ((TINF_V4SI)x1)[1];
+
+   return tinf_crc32_slice8(crc, (const unsigned char *)p, tail);
+}
+
+/* check CPUID for SSE2 and PCLMULQDQ, SSE must already be enabled in
+ * CR4 */
+static int tinf_has_pclmul(void)
+{
+   unsigned int eax = 1, ebx, ecx, edx;
+
+   __asm__ ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+   return (edx & (1 << 26)) && (ecx & (1 << 1));
+}
+
+/* build the tables and pick the fastest implementation */
+static void tinf_crc32_init(void)
+{
+   unsigned int i, j, crc;
+
+   for (i = 0; i < 256; ++i)
+   {
+      for (crc = i, j = 0; j < 8; ++j)
+         crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+
+      tinf_crc32tab[0][i] = crc;
+   }
+
+   for (i = 0; i < 256; ++i)
+      for (j = 1; j < 8; ++j)
+      {
+         crc = tinf_crc32tab[j - 1][i];
+         tinf_crc32tab[j][i] = (crc >> 8) ^ tinf_crc32tab[0][crc & 0xff];
+      }
+
+   tinf_crc32_fn = tinf_has_pclmul() ? tinf_crc32_pclmul : tinf_crc32_slice8;
+}
+
+unsigned int tinf_crc32_update(unsigned int crc, const void *data, unsigned int length)
+{
+   if (length == 0) return crc;
+
+   if (!tinf_crc32_fn) tinf_crc32_init();
+
+   return tinf_crc32_fn(crc ^ 0xffffffff, (const unsigned char *)data, length) ^ 0xffffffff;
+}
+
+#endif /* TINF_SMALL */
+
+unsigned int tinf_crc32(const void *data, unsigned int length)
+{
+   return tinf_crc32_update(0, data, length);
+}
@@ -15,25 +15,61 @@
 #include <elf.h>
 #include <util.h>
 #include <mbi-tools.h>
+#include <smp.h>
+#include <cpuid.h>
+#include <tinf.h>
+#include <memops.h>
 
 enum {
   EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI
 };
 
+/* Opcodes */
+enum {
+  OP_MOVSB     = 0xA4,
+  OP_MOVSD     = 0xA5,
+  OP_STOSB     = 0xAA,
+  OP_STOSD     = 0xAB,
+  OP_REP       = 0xF3,
+  OP_STD       = 0xFD,
+  OP_CLD       = 0xFC,
+};
+
+enum {
+  TRAMPOLINE          = 0x7C00,
+  TRAMPOLINE_SIZE     = 0x1000,
+
+  ELF_MAX_SEGMENTS    = 32,
+  ELF_SCRATCH_SIZE    = 32 << 10,
+  ELF_INFLATE_STATE   = 40 << 10,
+};
+
 static void
 byte_out(uint8_t **code, uint8_t byte)
 {
+  assert(*code < (uint8_t *)TRAMPOLINE + TRAMPOLINE_SIZE, "Trampoline too large.");
   **code = byte;
   (*code)++;
-  /* XXX Check overflow. */
 }
 
 static void
 gen_mov(uint8_t **code, int reg, uint32_t constant)
 {
   byte_out(code, 0xB8 | reg);
-  *((uint32_t *)*code) = constant;
-  *code += sizeof(uint32_t);
+  for (unsigned i = 0; i < sizeof(uint32_t); i++)
+    byte_out(code, constant >> (8 * i));
+}
+
+/** REP string instruction with the count in ECX. Nothing for count 0. */
+static void
+gen_rep(uint8_t **code, uint8_t op, uint32_t count)
+{
+  if (count == 0)
+    return;
+
+  gen_mov(code, ECX, count);
+  byte_out(code, OP_REP);
+  byte_out(code, op);
 }
 
 static void
@@ -42,19 +78,323 @@ gen_jmp_edx(uint8_t **code)
   byte_out(code, 0xFF); byte_out(code, 0xE2);
 }
 
+/**
+ * Copy len bytes with dword moves for the part where the target is
+ * aligned. If the target overlaps the end of the source, copy
+ * backwards, so nothing is overwritten before it is read.
+ */
+static void
+gen_copy(uint8_t **code, uint32_t target, uint32_t src, uint32_t len)
+{
+  if ((target > src) && (target - src < len)) {
+    uint32_t tail  = MIN((target + len) & 3, len);
+    uint32_t words = (len - tail) / 4;
+    uint32_t head  = len - tail - words * 4;
+
+    byte_out(code, OP_STD);
+    if (tail) {
+      gen_mov(code, EDI, target + len - 1);
+      gen_mov(code, ESI, src + len - 1);
+      gen_rep(code, OP_MOVSB, tail);
+    }
+    /* Now in front of the last dword. */
+    if (words) {
+      gen_mov(code, EDI, target + head + (words - 1) * 4);
+      gen_mov(code, ESI, src + head + (words - 1) * 4);
+      gen_rep(code, OP_MOVSD, words);
+    }
+    if (head) {
+      gen_mov(code, EDI, target + head - 1);
+      gen_mov(code, ESI, src + head - 1);
+      gen_rep(code, OP_MOVSB, head);
+    }
+    byte_out(code, OP_CLD);
+  } else {
+    uint32_t head  = MIN(-target & 3, len);
+    uint32_t words = (len - head) / 4;
+    uint32_t tail  = len - head - words * 4;
+
+    gen_mov(code, EDI, target);
+    gen_mov(code, ESI, src);
+    gen_rep(code, OP_MOVSB, head);
+    gen_rep(code, OP_MOVSD, words);
+    gen_rep(code, OP_MOVSB, tail);
+  }
+}
+
+/**
+ * Zero len bytes. Large areas are zeroed with non-temporal stores
+ * (MOVNTI), which do not drag the whole BSS through the cache. This
+ * needs SSE2. EAX is zero in the trampoline.
+ */
+static void
+gen_zero(uint8_t **code, uint32_t target, uint32_t len, bool stream)
+{
+  gen_mov(code, EDI, target);
+
+  if (stream && (len >= MEM_STREAM_MIN)) {
+    uint32_t head   = -target & 15;
+    uint32_t blocks = (len - head) / 16;
+    uint32_t tail   = len - head - blocks * 16;
+
+    gen_rep(code, OP_STOSB, head);
+    gen_mov(code, ECX, blocks);
+
+    uint8_t *loop = *code;
+    for (unsigned i = 0; i < 16; i += 4) {
+      /* MOVNTI [EDI + i], EAX */
+      byte_out(code, 0x0F); byte_out(code, 0xC3); byte_out(code, 0x47); byte_out(code, i);
+    }
+    byte_out(code, 0x83); byte_out(code, 0xC7); byte_out(code, 16); /* ADD EDI, 16 */
+    byte_out(code, 0x49);                                           /* DEC ECX */
+    byte_out(code, 0x75); byte_out(code, loop - (*code + 1));       /* JNZ loop */
+    byte_out(code, 0x0F); byte_out(code, 0xAE); byte_out(code, 0xF8); /* SFENCE */
+
+    gen_rep(code, OP_STOSB, tail);
+  } else {
+    uint32_t head  = MIN(-target & 3, len);
+    uint32_t words = (len - head) / 4;
+    uint32_t tail  = len - head - words * 4;
+
+    gen_rep(code, OP_STOSB, head);
+    gen_rep(code, OP_STOSD, words);
+    gen_rep(code, OP_STOSB, tail);
+  }
+}
+
 static void
 gen_elf_segment(uint8_t **code, uintptr_t target, void *src, size_t len,
-                size_t fill)
+                size_t fill, bool stream)
 {
-  gen_mov(code, EDI, (uint32_t)target);
-  gen_mov(code, ESI, (uint32_t)src);
-  gen_mov(code, ECX, len);
-  byte_out(code, 0xF3);         /* REP */
-  byte_out(code, 0xA4);         /* MOVSB */
-  /* EAX is zero at this point. */
-  gen_mov(code, ECX, fill);
-  byte_out(code, 0xF3);         /* REP */
-  byte_out(code, 0xAA);         /* STOSB */
+  assert(!((target < TRAMPOLINE + TRAMPOLINE_SIZE) && (TRAMPOLINE < target + len + fill)),
+         "ELF segment overlaps the trampoline.");
+
+  gen_copy(code, target, (uint32_t)src, len);
+  gen_zero(code, target + len, fill, stream);
+}
+
+/* A PT_LOAD segment. */
+struct elf_segment {
+  uint32_t offset;
+  uint32_t filesz;
+  uint32_t memsz;
+  uint32_t paddr;
+};
+
+static uint8_t elf_scratch[ELF_SCRATCH_SIZE];
+static uint8_t elf_inflate_state[ELF_INFLATE_STATE];
+
+/**
+ * Collect the loadable segments of the ELF image, whose first len
+ * bytes are at elf. Returns their number or -1, if the program
+ * headers are not within these bytes or a segment is out of reach.
+ */
+static int
+elf_segments(const uint8_t *elf, size_t len, struct elf_segment *seg, uint32_t *entry)
+{
+  unsigned n = 0;
+
+  if ((len < sizeof(struct eh64)) || (memcmp(elf, ELFMAG, SELFMAG) != 0))
+    return -1;
+
+#define SEGMENTS(EH, PH) {                                              \
+    const struct EH *elfc = (const struct EH *)elf;                     \
+    if ((elfc->e_type != 2) || ((elfc->e_machine != EM_386) && (elfc->e_machine != EM_X86_64)) || \
+        (elfc->e_version != 1) || (elfc->e_phentsize < sizeof(struct PH)) || \
+        (elfc->e_phoff + (uint64_t)elfc->e_phnum * elfc->e_phentsize > len)) \
+      return -1;                                                        \
+                                                                        \
+    for (unsigned i = 0; i < elfc->e_phnum; i++) {                      \
+      const struct PH *ph = (const struct PH *)(elf + elfc->e_phoff + i*elfc->e_phentsize); \
+      if (ph->p_type != 1)                                              \
+        continue;                                                       \
+      if ((n == ELF_MAX_SEGMENTS) || (ph->p_filesz > ph->p_memsz) ||    \
+          ((uint64_t)ph->p_offset + ph->p_filesz > ~0U) ||              \
+          ((uint64_t)ph->p_paddr + ph->p_memsz > ~0U))                  \
+        return -1;                                                      \
+      seg[n].offset = ph->p_offset;                                     \
+      seg[n].filesz = ph->p_filesz;                                     \
+      seg[n].memsz  = ph->p_memsz;                                      \
+      seg[n].paddr  = ph->p_paddr;                                      \
+      n++;                                                              \
+    }                                                                   \
+                                                                        \
+    *entry = elfc->e_entry;                                             \
+  }
+
+  switch (elf[EI_CLASS]) {
+  case ELFCLASS32:
+    SEGMENTS(eh, ph);
+    break;
+  case ELFCLASS64:
+    SEGMENTS(eh64, ph64);
+    break;
+  default:
+    return -1;
+  }
+
+  return n;
+}
+
+/**
+ * Check that a segment at [start, end) destroys nothing we still
+ * need: modules, boot data, the trampolines or what we allocated from
+ * the memory map, like the OHCI DMA buffers. Segments are written
+ * while we run, so they have to be in memory the map says is free.
+ */
+static bool
+elf_range_free(const struct mbi *mbi, uintptr_t start, uintptr_t end)
+{
+  const struct module *mods = (const struct module *)mbi->mods_addr;
+
+  if (mbi_overlaps_boot_data(mbi, start, end) || !mbi_memory_available(mbi, start, end) ||
+      ((start < TRAMPOLINE + TRAMPOLINE_SIZE) && (TRAMPOLINE < end)) ||
+      ((start < SMP_TRAMPOLINE + SMP_TRAMPOLINE_SIZE) && (SMP_TRAMPOLINE < end)))
+    return false;
+
+  for (unsigned j = 0; j < mbi->mods_count; j++)
+    if ((start < mods[j].mod_end) && (mods[j].mod_start < end))
+      return false;
+
+  return true;
+}
+
+static bool
+elf_segments_free(const struct mbi *mbi, const struct elf_segment *seg, unsigned n)
+{
+  for (unsigned i = 0; i < n; i++)
+    if (!elf_range_free(mbi, seg[i].paddr, seg[i].paddr + seg[i].memsz))
+      return false;
+
+  return true;
+}
+
+/** Copy what belongs to segments from the image bytes at [pos, pos + len). */
+static void
+elf_scatter(const struct elf_segment *seg, unsigned n, size_t pos,
+            const uint8_t *data, size_t len)
+{
+  for (unsigned i = 0; i < n; i++) {
+    size_t start = MAX(pos, (size_t)seg[i].offset);
+    size_t end   = MIN(pos + len, (size_t)seg[i].offset + seg[i].filesz);
+
+    if (start < end)
+      memcpy((void *)(uintptr_t)(seg[i].paddr + start - seg[i].offset),
+             data + start - pos, end - start);
+  }
+}
+
+static uint32_t
+le32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+ * Inflate a gzip'd ELF module window by window and copy its segments
+ * straight to their physical addresses. This saves inflating it to a
+ * relocation block first and copying it from there once more.
+ *
+ * Returns false before writing any segment, if the module has more
+ * than one gzip member, the program headers are not in the first
+ * window or the segments would overwrite something. Then the module has to be loaded the usual way.
+ */
+static bool
+elf_inflate_segments(struct mbi *mbi, struct module *m, uint32_t *entry)
+{
+  const uint8_t *src = (const uint8_t *)m->mod_start;
+  size_t len = m->mod_end - m->mod_start;
+  struct elf_segment seg[ELF_MAX_SEGMENTS];
+  unsigned hlen;
+  TINF_STREAM s;
+
+  if ((tinf_gzip_header(src, len, &hlen) != TINF_OK) || (len - hlen < 8))
+    return false;
+
+  /* The stream ends with the first member. Modules made of several
+     are left to the relocation, which inflates them member by
+     member. */
+  size_t mlen = gzip_member_len(src, len);
+  if (mlen && (mlen != len))
+    return false;
+
+  assert(tinf_stream_size() <= sizeof(elf_inflate_state), "Inflate state too large.");
+
+  /* tinf's checksums want SSE. */
+  enable_sse();
+  tinf_init();
+  tinf_stream_init(&s, elf_inflate_state, TINF_SUM_CRC32);
+
+  s.next_in  = src + hlen;
+  s.avail_in = len - hlen - 8;
+  s.next_out = elf_scratch;
+  s.avail_out = sizeof(elf_scratch);
+
+  int res = tinf_stream_inflate(&s);
+  size_t have = sizeof(elf_scratch) - s.avail_out;
+  int n = elf_segments(elf_scratch, have, seg, entry);
+
+  if ((res == TINF_DATA_ERROR) || (n < 0) || !elf_segments_free(mbi, seg, n))
+    return false;
+
+  printf("Inflating %u bytes straight to %u ELF segments...\n", len, n);
+
+  size_t pos = 0;
+  for (;;) {
+    elf_scatter(seg, n, pos, elf_scratch, have);
+    pos += have;
+
+    /* Output space left means the input ran out. */
+    if ((res != TINF_OK) || (s.avail_out != 0))
+      break;
+
+    background_poll();
+
+    s.next_out = elf_scratch;
+    s.avail_out = sizeof(elf_scratch);
+
+    res = tinf_stream_inflate(&s);
+    have = sizeof(elf_scratch) - s.avail_out;
+  }
+
+  assert((res == TINF_DONE) && (s.checksum == le32(src + len - 8)) &&
+         (s.total_out == le32(src + len - 4)), "Error decompressing data.");
+
+  for (int i = 0; i < n; i++) {
+    assert(seg[i].offset + seg[i].filesz <= pos, "ELF segment beyond end of file");
+    memset((void *)(uintptr_t)(seg[i].paddr + seg[i].filesz), 0,
+           seg[i].memsz - seg[i].filesz);
+
+    /* The other modules are relocated afterwards. */
+    mbi_reserve_range(seg[i].paddr, seg[i].paddr + seg[i].memsz);
+  }
+
+  return true;
+}
+
+/**
+ * Returns the descriptor if the module is one of a pre-placed image
+ * instead of an ELF file. The host wrote the segments without asking
+ * us, so we can only panic, if they are where they should not be.
+ */
+static struct placed_image *
+placed_image(const struct mbi *mbi, const struct module *m)
+{
+  struct placed_image *p = (struct placed_image *)m->mod_start;
+  size_t len = m->mod_end - m->mod_start;
+
+  if ((len < sizeof(*p)) || (p->magic != PLACED_MAGIC))
+    return NULL;
+
+  assert(p->count <= (len - sizeof(*p)) / sizeof(p->seg[0]),
+         "Truncated image descriptor.");
+  for (unsigned i = 0; i < p->count; i++) {
+    assert((p->seg[i].filesz <= p->seg[i].memsz) &&
+           (p->seg[i].addr + (uint64_t)p->seg[i].memsz <= ~0U), "Invalid placed segment.");
+    assert(elf_range_free(mbi, p->seg[i].addr, p->seg[i].addr + p->seg[i].memsz),
+           "Placed segment overwrites the loader, boot data or reserved memory.");
+  }
+  return p;
 }
 
 int
@@ -65,12 +405,37 @@ start_module(struct mbi *mbi, bool uncompress)
     return -1;
   }
 
-  if (uncompress || (mbi->mods_count > 1)) {
+  struct module *m  = (struct module *) mbi->mods_addr;
+  uint8_t *code = (uint8_t *)TRAMPOLINE;
+  uint32_t entry;
+
+  /* The host may have placed the segments already. Only BSS is left
+     to clear then. The descriptor is consumed before the other
+     modules move, which have to stay clear of the segments. */
+  struct placed_image *placed = placed_image(mbi, m);
+
+  if (placed) {
+    bool stream = (mem_features() & MEM_SSE2) != 0;
+
+    printf("Image placed by the host, clearing BSS of %u segments.\n", placed->count);
+    for (unsigned i = 0; i < placed->count; i++) {
+      const struct placed_segment *seg = &placed->seg[i];
+
+      gen_elf_segment(&code, seg->addr + seg->filesz, NULL, 0, seg->memsz - seg->filesz, stream);
+      mbi_reserve_range(seg->addr, seg->addr + seg->memsz);
+    }
+    entry = placed->entry;
+  }
+
+  /* A compressed kernel may go straight to where it belongs. Only the
+     other modules are relocated then. */
+  bool loaded = placed || (uncompress && elf_inflate_segments(mbi, m, &entry));
+
+  if (!loaded && (uncompress || (mbi->mods_count > 1))) {
     mbi_relocate_modules(mbi, uncompress);
   }
 
   // skip module after loading
-  struct module *m  = (struct module *) mbi->mods_addr;
   mbi->mods_addr += sizeof(struct module);
   mbi->mods_count--;
   mbi->cmdline = m->string;
@@ -78,11 +443,20 @@ start_module(struct mbi *mbi, bool uncompress)
   // switch it on unconditionally, we assume that m->string is always initialized
   mbi->flags |=  MBI_FLAG_CMDLINE;
 
+  if (loaded && (mbi->mods_count > 0))
+    mbi_relocate_modules(mbi, uncompress);
+
+  if (loaded) {
+    gen_mov(&code, EAX, 0x2BADB002);
+    gen_mov(&code, EDX, entry);
+    goto jump;
+  }
+
   // check elf header
   struct eh *elf = (struct eh *) m->mod_start;
   assert(memcmp(elf->e_ident, ELFMAG, SELFMAG) == 0, "ELF header incorrect");
 
-  uint8_t *code = (uint8_t *)0x7C00;
+  bool stream = (mem_features() & MEM_SSE2) != 0;
 
 #define LOADER(EH, PH) {                                                \
     struct EH *elfc = (struct EH *)elf;                                               \
@@ -94,7 +468,7 @@ start_module(struct mbi *mbi, bool uncompress)
       if (ph->p_type != 1)                                              \
         continue;                                                       \
       gen_elf_segment(&code, ph->p_paddr, (void *)(uintptr_t)(m->mod_start+ph->p_offset), ph->p_filesz, \
-                      ph->p_memsz - ph->p_filesz);                      \
+                      ph->p_memsz - ph->p_filesz, stream);              \
     }                                                                   \
                                                                         \
     gen_mov(&code, EAX, 0x2BADB002);                                    \
@@ -112,8 +486,18 @@ start_module(struct mbi *mbi, bool uncompress)
     assert(false, "Invalid ELF class");
   }
 
+jump:
   gen_jmp_edx(&code);
-  asm volatile  ("jmp *%%edx" :: "a" (0), "d" (0x7C00), "b" (mbi));
+
+  /* Whatever ran alongside loading must be done before the OS
+     runs. It may have taken the APIC after the other processors, so
+     it lets go of it first. */
+  background_finish();
+
+  /* The OS expects the other processors in wait-for-SIPI. */
+  smp_park();
+
+  asm volatile  ("jmp *%%edx" :: "a" (0), "d" (TRAMPOLINE), "b" (mbi));
 
   /* NOT REACHED */
   return 0;
@@ -94,6 +94,33 @@ struct dmar {
   struct dmar_entry first_entry;
 };
 
+struct mcfg_entry {
+  uint64_t base;
+  uint16_t segment;
+  uint8_t  start_bus;
+  uint8_t  end_bus;
+  uint32_t _res;
+} __attribute__((packed));
+
+struct mcfg {
+  struct acpi_table generic;
+  char _res[8];
+  struct mcfg_entry entry[];
+} __attribute__((packed));
+
+struct hpet {
+  struct acpi_table generic;
+  uint32_t block_id;
+  uint8_t  address_space;	/* 0 is memory */
+  uint8_t  register_width;
+  uint8_t  register_offset;
+  uint8_t  _res;
+  uint64_t address;
+  uint8_t  number;
+  uint16_t min_tick;
+  uint8_t  page_protection;
+} __attribute__((packed));
+
 char acpi_checksum(const char *table, size_t count);
 void acpi_fix_checksum(struct acpi_table *tab);
 
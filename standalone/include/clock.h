@@ -0,0 +1,68 @@
+/* -*- Mode: C -*- */
+/*
+ * Time keeping with the TSC.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <asm.h>
+
+/* A point in time, as a TSC value. Checking it costs one RDTSC. */
+struct deadline {
+  uint64_t tsc;
+};
+
+/* Calibrate the TSC against the HPET, if ACPI has one, or the PIT
+   otherwise. Everything below does this on first use, so calling it
+   only moves the 10ms this takes to a convenient place. */
+void clock_init(void);
+
+/* TSC frequency and where it was measured against. */
+uint32_t clock_tsc_khz(void);
+const char *clock_source(void);
+
+uint64_t cycles_to_ns(uint64_t cycles);
+uint64_t ns_to_cycles(uint64_t ns);
+
+/* Nanoseconds since clock_init(). */
+uint64_t now_ns(void);
+
+/* Busy wait for at least the given time. */
+void ndelay(uint32_t ns);
+void udelay(uint32_t us);
+
+static inline struct deadline
+deadline_in_ns(uint64_t ns)
+{
+  struct deadline d = { rdtsc() + ns_to_cycles(ns) };
+  return d;
+}
+
+static inline struct deadline
+deadline_in_us(uint32_t us)
+{
+  return deadline_in_ns((uint64_t)us * 1000);
+}
+
+static inline bool
+deadline_passed(struct deadline d)
+{
+  return rdtsc() >= d.tsc;
+}
+
+/* EOF */
@@ -0,0 +1,49 @@
+/* -*- Mode: C -*- */
+/*
+ * Decompressors for boot modules.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* All codecs follow tinf_gzip_uncompress(): They return TINF_OK or
+   TINF_DATA_ERROR and store the uncompressed length in *destLen. If
+   dest is NULL, they only return the uncompressed length. Otherwise
+   *destLen is the size of dest on entry. gzip trusts the size from
+   its trailer instead. */
+typedef int (*codec_uncompress_fn)(void *dest, unsigned int *destLen,
+                                   const void *source, unsigned int sourceLen);
+
+struct codec {
+  const char *name;
+  bool (*probe)(const void *source, unsigned int sourceLen);
+  codec_uncompress_fn uncompress;
+};
+
+const struct codec *codec_detect(const void *source, unsigned int sourceLen);
+
+int lz4_uncompress(void *dest, unsigned int *destLen,
+                   const void *source, unsigned int sourceLen);
+
+int zstd_uncompress(void *dest, unsigned int *destLen,
+                    const void *source, unsigned int sourceLen);
+
+uint32_t xxh32(const void *data, unsigned int len, uint32_t seed);
+uint64_t xxh64(const void *data, unsigned int len, uint64_t seed);
+
+/* EOF */
@@ -21,6 +21,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <asm.h>
 
 enum IA32_MSRs {
   IA32_APIC_BASE = 0x001b,
@@ -32,6 +33,27 @@ enum IA32_APIC_MSR {
   APIC_ENABLE            = 1<<11,
 };
 
+enum {
+  CR0_MP         = 1 << 1,
+  CR0_EM         = 1 << 2,
+  CR4_OSFXSR     = 1 << 9,
+  CR4_OSXMMEXCPT = 1 << 10,
+};
+
+enum CPUID_1_ECX {
+  CPUID_1_ECX_MONITOR = 1 << 3,
+};
+
+enum CPUID_1_EDX {
+  CPUID_1_EDX_FXSR = 1 << 24,
+  CPUID_1_EDX_SSE  = 1 << 25,
+  CPUID_1_EDX_SSE2 = 1 << 26,
+};
+
+enum CPUID_7_EBX {
+  CPUID_7_EBX_ERMS = 1 << 9,
+};
+
 /**
  * Uses CPUID to find out if the CPU has an enabled APIC.
  */
@@ -46,6 +68,20 @@ has_apic(void)
   return ((edx >> 9) & 1) != 0;
 }
 
+/**
+ * Uses CPUID to find out if we can use MONITOR/MWAIT.
+ */
+static inline bool
+has_monitor(void)
+{
+  uint32_t eax = 1;
+  uint32_t ecx;
+
+  asm ("cpuid" : "+a" (eax), "=c" (ecx) :: "ebx", "edx");
+
+  return (ecx & CPUID_1_ECX_MONITOR) != 0;
+}
+
 /**
  * Tries to enable the APIC. Should work for anything after the P6.
  */
@@ -66,4 +102,23 @@ enable_apic(void)
   asm volatile ("wrmsr" :: "a" (low), "d" (hi), "c" (IA32_APIC_BASE));
 }
 
+/**
+ * Enables SSE instructions, if the CPU has them. The boot loader
+ * leaves them disabled, but tinf uses them for checksums.
+ */
+static inline void
+enable_sse(void)
+{
+  uint32_t eax = 1;
+  uint32_t edx;
+
+  asm ("cpuid" : "+a" (eax), "=d" (edx) :: "ebx", "ecx");
+
+  if ((edx & (CPUID_1_EDX_FXSR | CPUID_1_EDX_SSE)) != (CPUID_1_EDX_FXSR | CPUID_1_EDX_SSE))
+    return;
+
+  set_cr0((get_cr0() & ~CR0_EM) | CR0_MP);
+  set_cr4(get_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+}
+
 /* EOF */
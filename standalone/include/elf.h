@@ -25,6 +25,26 @@
 
 int start_module(struct mbi *mbi, bool uncompress);
 
+/* An ELF image whose segments the boot host already wrote to their
+   physical addresses (boot/morbo.py --place). It is passed as the
+   first module instead of the ELF file. It lists the segments, whose
+   BSS is left to clear and which nothing else may overwrite, and the
+   entry point. */
+#define PLACED_MAGIC 0x4C504D4D /* "MMPL" */
+
+struct placed_segment {
+  uint32_t addr;
+  uint32_t filesz;
+  uint32_t memsz;
+};
+
+struct placed_image {
+  uint32_t magic;
+  uint32_t entry;
+  uint32_t count;
+  struct placed_segment seg[];
+};
+
 /* Definitions taken from elf.h. Copyright follows: */
 /* This file defines standard ELF types, structures, and macros.
    Copyright (C) 1995-2003,2004,2005,2006,2007,2008,2009,2010
@@ -0,0 +1,58 @@
+/* -*- Mode: C -*- */
+/*
+ * Interrupts for the boot loader.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pci.h>
+
+/* A remote node can wake us by sending this vector as a fixed
+   interrupt to 0xFEE00000. The interrupt itself does nothing. */
+#define IRQ_DOORBELL_VECTOR 0x42
+
+/* Runs with interrupts disabled. */
+typedef void (*irq_handler_fn)(void *arg);
+
+/* Install an IDT, enable the local APIC and start a 1ms timer tick.
+   Returns false, if there is no xAPIC to drive this. */
+bool irq_init(void);
+
+/* Deliver the interrupts of a PCI function to fn. This uses MSI, if
+   the function has it, and its legacy PIC line otherwise. Returns
+   false, if neither works. There is one device at a time. */
+bool irq_route_pci(const struct pci_device *dev, irq_handler_fn fn, void *arg);
+
+/* Sleep until the next interrupt. Even without device interrupts,
+   the timer tick wakes us up every millisecond. */
+void irq_wait(void);
+
+/* Serve pending interrupts without sleeping. */
+void irq_poll(void);
+
+/* Sleep until *word is written or an interrupt arrives. Uses
+   MONITOR/MWAIT on the cache line holding word, if the CPU has them,
+   and irq_wait() otherwise. Returns immediately, if *word is no
+   longer value. Like irq_wait(), this needs irq_init(). */
+void irq_wait_write(volatile uint32_t *word, uint32_t value);
+
+/* Undo everything, so the next OS finds interrupts as we found them:
+   disabled, masked and the APIC in its old state. */
+void irq_shutdown(void);
+
+/* EOF */
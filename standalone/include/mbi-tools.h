@@ -29,7 +29,17 @@ bool mbi_find_memory(const struct mbi *multiboot_info, size_t len,
 
 void *mbi_alloc_protected_memory(struct mbi *multiboot_info, size_t len, unsigned align);
 
+void mbi_reserve_range(uintptr_t start, uintptr_t end);
+
+void *mbi_alloc_scratch(const struct mbi *mbi, size_t len);
+
 void mbi_relocate_modules(struct mbi *mbi, bool uncompress);
 
+bool mbi_overlaps_boot_data(const struct mbi *mbi, uintptr_t start, uintptr_t end);
+
+bool mbi_memory_available(const struct mbi *mbi, uintptr_t start, uintptr_t end);
+
+size_t gzip_member_len(const uint8_t *p, size_t len);
+
 
 /* EOF */
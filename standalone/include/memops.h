@@ -0,0 +1,84 @@
+/* -*- Mode: C -*- */
+/*
+ * memcpy() and memset() variants.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* What a variant needs from the CPU. */
+enum mem_features {
+  MEM_ERMS = 1 << 0,            /* Fast REP MOVSB/STOSB */
+  MEM_SSE2 = 1 << 1,            /* SSE2, enabled in CR4 */
+};
+
+enum {
+  /* Below this, the SSE2 loops are not worth aligning the target. It
+     leaves at least one 64 byte block after alignment. */
+  MEM_SSE2_MIN   = 64 + 15,
+
+  /* From this size on, stores bypass the cache. Nobody touches
+     relocated modules again before the OS runs, and copies this large
+     do not fit into the cache anyway. The memcpy sweep in basicperf
+     shows the crossover, which is a bit below the size of the last
+     level cache. */
+  MEM_STREAM_MIN = 2 << 20,
+};
+
+typedef void *(*memcpy_fn)(void *dest, const void *src, size_t n);
+typedef void *(*memset_fn)(void *s, int c, size_t n);
+
+void *memcpy_movsb(void *dest, const void *src, size_t n);
+void *memcpy_movsd(void *dest, const void *src, size_t n);
+void *memcpy_sse2(void *dest, const void *src, size_t n);
+void *memcpy_stream(void *dest, const void *src, size_t n);
+
+/* Copy from the end down, for a dest above an overlapping src. */
+void *memmove_back_movsd(void *dest, const void *src, size_t n);
+void *memmove_back_sse2(void *dest, const void *src, size_t n);
+void *memmove_back_stream(void *dest, const void *src, size_t n);
+
+void *memset_stosb(void *s, int c, size_t n);
+void *memset_stosd(void *s, int c, size_t n);
+void *memset_sse2(void *s, int c, size_t n);
+void *memset_stream(void *s, int c, size_t n);
+
+struct mem_variant {
+  const char *name;
+  unsigned needs;               /* enum mem_features */
+  memcpy_fn copy;
+  memset_fn set;
+};
+
+extern const struct mem_variant mem_variants[];
+extern const unsigned mem_variant_count;
+
+/* What memcpy(), memmove() and memset() use below and from
+   MEM_STREAM_MIN on. */
+struct mem_ops {
+  memcpy_fn copy, copy_large;
+  memcpy_fn move_back, move_back_large;
+  memset_fn set, set_large;
+};
+
+extern struct mem_ops mem_ops;
+
+unsigned mem_features(void);
+void mem_init(void);
+
+/* EOF */
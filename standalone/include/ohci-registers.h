@@ -36,6 +36,7 @@
 #define  BusOptions_cmc              (1<<30)
 #define  BusOptions_isc              (1<<29)
 #define  BusOptions_bmc              (1<<28)
+#define  BusOptions_max_rec          (0xF<<12)
 #define GUIDHi                       0x024
 #define GUIDLo                       0x028
 #define ConfigROMmap                 0x034
@@ -22,9 +22,32 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <pci.h>
+#include <clock.h>
 
 #include <ohci-crm.h>
 
+/* Bring-up goes through these in order. Each state waits for the
+   hardware to do something. */
+enum ohci_init_state {
+  OHCI_INIT_SOFTRESET,
+  OHCI_INIT_LPS,
+  OHCI_INIT_PHY_CONFIG,
+  OHCI_INIT_LINK_ENABLE,
+  OHCI_INIT_BUS_RESET,
+  OHCI_INIT_SELF_ID,
+  OHCI_INIT_DONE,
+  OHCI_INIT_FAILED,
+};
+
+enum link_speed {
+  SPEED_S100 = 0U,
+  SPEED_S200 = 1U,
+  SPEED_S400 = 2U,
+  SPEED_S800 = 3U,
+
+  SPEED_MAX  = ~0U,
+};
+
 struct ohci_controller {
 
   const struct pci_device *pci;	/* PCI device info. */
@@ -37,23 +60,70 @@ struct ohci_controller {
   uint8_t total_ports;
   bool enhanced_phy_map;
   bool posted_writes;
+  uint32_t quirks;		/* From the PCI database */
+
+  bool irq;			/* Events arrive as interrupts */
+  volatile unsigned interrupts;	/* Interrupts handled so far */
+
+  /* Bring-up state, see ohci_init_poll() */
+  enum ohci_init_state state;
+  struct deadline timeout;	/* For the current state */
+  struct deadline next_poll;	/* Don't look at the hardware before */
+  unsigned step;		/* Current backoff in us */
+  unsigned lps_retries;
+  bool phy_read_pending;
+  uint8_t generation;		/* Before our bus reset */
+  bool use_irq;
+  enum link_speed speed;
+  uint64_t bringup_start;	/* In ns */
 
 };
 
-enum link_speed {
-  SPEED_S100 = 0U,
-  SPEED_S200 = 1U,
-  SPEED_S400 = 2U,
+/* Posted writes are used if the PCI database says they are safe,
+   unless the user says otherwise. */
+enum posted_writes {
+  POSTED_WRITES_AUTO,
+  POSTED_WRITES_ON,
+  POSTED_WRITES_OFF,
+};
 
-  SPEED_MAX  = ~0U,
+/* What a controller offers, as far as we can tell without bringing
+   it up. */
+struct ohci_link_info {
+  enum link_speed speed;	/* link_spd from BusOptions */
+  uint8_t ports;		/* From PHY register 2, 0 if the PHY is silent */
+  uint64_t guid;
 };
 
+bool    ohci_probe(const struct pci_device *pci_dev,
+		   struct ohci_link_info *info);
 void    ohci_poll_events(struct ohci_controller *ohci);
+
+/* Bring up a controller in the background: ohci_init_start() kicks
+   it off, ohci_init_poll() advances it without waiting and
+   ohci_init_finish() blocks until it is done. ohci_initialize() does
+   all of it at once. Both return false, if the controller cannot be
+   used. */
+bool    ohci_init_start(const struct pci_device *pci_dev,
+			struct ohci_controller *ohci,
+			enum posted_writes posted_writes,
+			bool tune_pcie,
+			bool use_irq,
+			enum link_speed speed);
+enum ohci_init_state ohci_init_poll(struct ohci_controller *ohci);
+bool    ohci_init_finish(struct ohci_controller *ohci);
+
 bool    ohci_initialize(const struct pci_device *pci_dev,
 			struct ohci_controller *ohci,
-			bool posted_writes,
+			enum posted_writes posted_writes,
+			bool tune_pcie,
+			bool use_irq,
 			enum link_speed speed);
 
+/* Mask controller interrupts and hand the CPU back in the state we
+   found it. Call this before starting the next OS. */
+void    ohci_disable_interrupts(struct ohci_controller *ohci);
+
 uint8_t ohci_wait_nodeid(struct ohci_controller *ohci);
 void    ohci_force_bus_reset(struct ohci_controller *ohci);
 
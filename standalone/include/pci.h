@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pci_db.h>
+#include <mbi.h>
 
 enum pci_class {
   PCI_CLASS_BRIDGE_DEV      = 0x06,
@@ -45,10 +46,58 @@ enum pci_subclass {
 enum pci_config_space {
   PCI_CFG_VENDOR_ID = 0x0,
   PCI_CFG_REVID = 0x08,         /* Read uint32 to get class code in upper 16bit */
+  PCI_CFG_CACHE_LINE = 0x0C,     /* In dwords */
+  PCI_CFG_LATENCY = 0x0D,
+  PCI_CFG_HEADER_TYPE = 0x0E,
   PCI_CFG_BAR0  = 0x10,
   PCI_CFG_BAR1  = 0x14,
   PCI_CFG_BAR2  = 0x18,
   PCI_CFG_BAR3  = 0x1C,
+  PCI_CFG_BUS_NUMBERS = 0x18,   /* Bridges: primary, secondary, subordinate */
+  PCI_CFG_SEC_LATENCY = 0x1B,   /* Bridges only */
+};
+
+/* Registers in the PCI Express capability */
+enum pci_exp {
+  PCI_EXP_FLAGS     = 0x02,     /* Port type in bits 4-7 */
+  PCI_EXP_DEVCAP    = 0x04,
+  PCI_EXP_DEVCTL    = 0x08,
+  PCI_EXP_LNKCAP    = 0x0C,
+  PCI_EXP_LNKSTA    = 0x12,
+
+  PCI_EXP_TYPE_ROOT_PORT = 0x4,
+
+  PCI_EXP_DEVCAP_PAYLOAD = 0x7, /* Max_Payload_Size supported */
+  PCI_EXP_DEVCTL_PAYLOAD = 0x00E0,
+  PCI_EXP_DEVCTL_READRQ  = 0x7000,
+  PCI_EXP_READRQ_4096    = 5,   /* 128 << 5 */
+};
+
+/* Conventional PCI devices and bridges get at least this. */
+enum {
+  PCI_MIN_LATENCY = 0x40,
+};
+
+/* Config space addresses are in the format of the address port. Bits
+   24-27 hold bits 8-11 of the register in the extended config space
+   of PCIe. Only memory-mapped config space reaches it. */
+enum pci_cfg_address {
+  PCI_CFG_EXT_MASK  = 0x0F000000,
+  PCI_CFG_EXT_SHIFT = 16,       /* From register bit 8 to bit 24 */
+};
+
+static inline unsigned
+pci_cfg_reg(unsigned addr, unsigned reg)
+{
+  return (addr & ~(PCI_CFG_EXT_MASK | 0xFF)) | (reg & 0xFF) |
+    ((reg & 0xF00) << PCI_CFG_EXT_SHIFT);
+}
+
+enum pci_header_type {
+  PCI_HEADER_TYPE_MASK    = 0x7F,
+  PCI_HEADER_MULTI_FUNC   = 0x80,
+  PCI_HEADER_BRIDGE       = 0x01,
+  PCI_HEADER_CARDBUS      = 0x02,
 };
 
 enum pci_constants {
@@ -69,13 +118,60 @@ struct pci_device {
   uint32_t cfg_address;		/* Address of config space */
 };
 
+enum pci_table_constants {
+  PCI_TABLE_MAGIC  = 0x54494350, /* "PCIT" */
+  PCI_MAX_DEVICES  = 256,
+};
+
+/* A function found while enumerating the bus. */
+struct pci_entry {
+  uint32_t cfg_address;
+  uint16_t vendor_id;
+  uint16_t device_id;
+  uint32_t class_rev;           /* As PCI_CFG_REVID */
+  uint8_t  header_type;
+  uint8_t  secondary_bus;       /* Bridges only */
+  uint8_t  subordinate_bus;
+  uint8_t  reserved;
+};
+
+/* All functions reachable from the root bus, ordered by address. */
+struct pci_table {
+  uint32_t magic;
+  uint32_t count;
+  struct pci_entry dev[];
+};
+
 /* Low-Level PCI Access */
 uint8_t pci_read_uint8(unsigned addr);
 uint32_t pci_read_uint32(unsigned addr);
+void pci_write_uint32(unsigned addr, uint32_t value);
+uint16_t pci_read_uint16(unsigned addr);
+void pci_write_uint16(unsigned addr, uint16_t value);
+void pci_write_uint8(unsigned addr, uint8_t value);
+
+/* Use memory-mapped config space from the ACPI MCFG table for the
+   accessors above. Returns false, if there is none. pci_init() does
+   this. */
+bool pci_ecam_init(void);
+
+/* The two backends, for comparing them. pci_ecam_read_uint32() needs
+   pci_ecam_init() to have succeeded. */
+uint8_t pci_port_read_uint8(unsigned addr);
+uint32_t pci_port_read_uint32(unsigned addr);
+uint32_t pci_ecam_read_uint32(unsigned addr);
 
 
 uint32_t pci_cfg_read_uint32(const struct pci_device *dev, uint32_t offset);
 
+/* Take the device table an earlier stage left in the memory map or
+   enumerate the bus and leave the table there for the next stage. */
+void pci_init(struct mbi *mbi);
+
+/* The device table. Enumerates the bus on first use, if pci_init()
+   was not called. */
+const struct pci_table *pci_devices(void);
+
 /* Find a device by its class. Always finds the last device of the
    given class. On success, returns true and fills out the given
    pci_device structure. If subclass is 0xFF, it will be
@@ -83,6 +179,21 @@ uint32_t pci_cfg_read_uint32(const struct pci_device *dev, uint32_t offset);
 bool pci_find_device_by_class(uint8_t class, uint8_t subclass,
 			      struct pci_device *dev);
 
+/* Find up to max devices of the given class, in the order of their
+   addresses. Returns how many there are. The subclass is handled as
+   in pci_find_device_by_class(). */
+unsigned pci_find_devices_by_class(uint8_t class, uint8_t subclass,
+                                   struct pci_device *devs, unsigned max);
+
 unsigned char pci_find_cap(unsigned addr, unsigned char id);
 
+/* Returns the bridge that leads to the bus of addr or 0 on a root
+   bus. */
+uint32_t pci_upstream_bridge(unsigned addr);
+
+/* Tune the path from a device to its root port for DMA throughput:
+   raise Max Payload Size and Max Read Request Size and set up cache
+   line size and latency timers of conventional PCI devices. */
+void pci_tune_path(unsigned addr);
+
 /* EOF */
@@ -25,12 +25,17 @@ struct pci_db_entry {
   uint16_t vendor_id;
   uint16_t device_id;
   uint32_t quirks;
+  uint8_t  max_rec;		/* Largest max_rec we trust, 0 to keep BusOptions */
   const char *device_name;
 };
 
+/* Without flags, a controller gets the conservative defaults. */
 enum controller_quirks {
   NO_QUIRKS = 0,
-  /* ... */
+  QUIRK_POSTED_WRITES_OK = 1 << 0, /* Posted writes are enabled by default. */
+  QUIRK_NO_1394A         = 1 << 1, /* Leave the IEEE1394a enhancements alone. */
+  QUIRK_CROM_SWAP        = 1 << 2, /* ConfigROMhdr and BusOptions are reloaded
+				      byte swapped. See ohci_load_crom(). */
 };
 
 const struct pci_db_entry * pci_lookup_device(uint16_t vendor_id, uint16_t device_id);
@@ -0,0 +1,45 @@
+/* -*- Mode: C -*- */
+/*
+ * Application processor work pool.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <mbi.h>
+
+/* The page the application processors start in. Its contents are
+   only borrowed while they come up. */
+enum {
+  SMP_TRAMPOLINE      = 0x7000,
+  SMP_TRAMPOLINE_SIZE = 0x1000,
+};
+
+/* Jobs must not print or assert. They run concurrently on all
+   processors. */
+typedef void (*smp_job_fn)(unsigned index, void *arg);
+
+unsigned smp_init(const struct mbi *mbi);
+void smp_for_each(unsigned count, smp_job_fn job, void *arg);
+void smp_park(void);
+
+/* smp.c and irq.c both enable the local APIC through its spurious
+   vector register. The first to take the APIC saves the register, the
+   last to let go of it restores the value we found. */
+void apic_svr_take(volatile uint32_t *apic);
+void apic_svr_release(volatile uint32_t *apic);
+
+/* EOF */
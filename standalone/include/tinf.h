@@ -27,6 +27,27 @@ extern "C" {
 
 #define TINF_OK             0
 #define TINF_DATA_ERROR    (-3)
+#define TINF_DONE           1
+
+/* checksums computed while inflating */
+#define TINF_SUM_NONE       0
+#define TINF_SUM_CRC32      1
+#define TINF_SUM_ADLER32    2
+
+/* incremental inflate state, next_in/avail_in and next_out/avail_out
+   are advanced by tinf_stream_inflate() */
+typedef struct {
+   const unsigned char *next_in;
+   unsigned int avail_in;
+
+   unsigned char *next_out;
+   unsigned int avail_out;
+
+   unsigned int total_out;
+   unsigned int checksum;
+
+   void *state;
+} TINF_STREAM;
 
 /* function prototypes */
 
@@ -35,6 +56,19 @@ void TINFCC tinf_init();
 int TINFCC tinf_uncompress(void *dest, unsigned int *destLen,
                            const void *source, unsigned int sourceLen);
 
+int TINFCC tinf_uncompress_sum(void *dest, unsigned int *destLen,
+                               const void *source, unsigned int sourceLen,
+                               int sum, unsigned int *checksum);
+
+unsigned int TINFCC tinf_stream_size(void);
+
+int TINFCC tinf_stream_init(TINF_STREAM *s, void *state, int sum);
+
+int TINFCC tinf_stream_inflate(TINF_STREAM *s);
+
+int TINFCC tinf_gzip_header(const void *source, unsigned int sourceLen,
+                            unsigned int *headerLen);
+
 int TINFCC tinf_gzip_uncompress(void *dest, unsigned int *destLen,
                                 const void *source, unsigned int sourceLen);
 
@@ -43,8 +77,14 @@ int TINFCC tinf_zlib_uncompress(void *dest, unsigned int *destLen,
 
 unsigned int TINFCC tinf_adler32(const void *data, unsigned int length);
 
+unsigned int TINFCC tinf_adler32_update(unsigned int adler, const void *data,
+                                        unsigned int length);
+
 unsigned int TINFCC tinf_crc32(const void *data, unsigned int length);
 
+unsigned int TINFCC tinf_crc32_update(unsigned int crc, const void *data,
+                                      unsigned int length);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
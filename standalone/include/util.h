@@ -24,6 +24,7 @@
 #include <stdarg.h>
 
 #include "asm.h"
+#include "clock.h"
 
 #define assert(X, msg, args...)						\
   do {									\
@@ -52,6 +53,7 @@ char *strcpy(char * __restrict dst, const char * __restrict src);
 char *strncpy(char * __restrict dst, const char * __restrict src, size_t n);
 size_t strlen(const char *s);
 void *memcpy(void *dest, const void *src, size_t n);
+void *memmove(void *dest, const void *src, size_t n);
 void *memset(void *s, int c, size_t n);
 int memcmp(const void *s1, const void *s2, size_t n);
 
@@ -71,6 +73,15 @@ void wait(int ms);
 void __exit(unsigned status) __attribute__((regparm(1), noreturn));
 void reboot(void) __attribute__((noreturn));
 
+/* Work that makes progress while we load modules. poll must return
+   quickly, finish blocks until the work is done. Only one at a
+   time. */
+typedef void (*background_fn)(void *arg);
+
+void background_start(background_fn poll, background_fn finish, void *arg);
+void background_poll(void);
+void background_finish(void);
+
 /* Boot info */
 extern struct mbi *multiboot_info;
 
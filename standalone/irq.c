@@ -0,0 +1,372 @@
+/* -*- Mode: C -*- */
+/*
+ * Interrupts for the boot loader.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+/* We only have a handful of vectors: the timer tick, one device
+   either through MSI or through the legacy PIC, and the spurious
+   vector. Which GSI a PCI pin is wired to on the I/O APIC is only
+   known to ACPI byte code, so the PIC line the BIOS left in config
+   space is the fallback to MSI. */
+
+#include <stdint.h>
+#include <util.h>
+#include <cpuid.h>
+#include <pci.h>
+#include <irq.h>
+#include <smp.h>
+
+enum {
+  VECTOR_PIC_MASTER  = 0x20,
+  VECTOR_PIC_SLAVE   = 0x28,
+  VECTOR_DEVICE      = 0x40,
+  VECTOR_TIMER       = 0x41,
+  VECTOR_DOORBELL    = IRQ_DOORBELL_VECTOR,
+  VECTOR_SPURIOUS    = 0xFF,
+
+  /* Where the BIOS has the PIC */
+  VECTOR_BIOS_MASTER = 0x08,
+  VECTOR_BIOS_SLAVE  = 0x70,
+};
+
+enum {
+  APIC_X2APIC_ENABLE = 1 << 10,
+
+  APIC_ID            = 0x20,
+  APIC_EOI           = 0xB0,
+  APIC_SVR           = 0xF0,
+  APIC_LVT_TIMER     = 0x320,
+  APIC_TIMER_INIT    = 0x380,
+  APIC_TIMER_CUR     = 0x390,
+  APIC_TIMER_DIV     = 0x3E0,
+
+  APIC_SVR_ENABLE    = 1 << 8,
+  APIC_LVT_MASKED    = 1 << 16,
+  APIC_LVT_PERIODIC  = 1 << 17,
+  APIC_DIV_16        = 0x3,
+
+  MSI_ADDRESS        = 0xFEE00000,
+};
+
+enum {
+  PIC_MASTER_CMD = 0x20,
+  PIC_MASTER_DATA = 0x21,
+  PIC_SLAVE_CMD  = 0xA0,
+  PIC_SLAVE_DATA = 0xA1,
+  PIC_EOI        = 0x20,
+  PIC_CASCADE    = 2,
+
+  PCI_CAP_ID_MSI = 0x05,
+  PCI_CFG_COMMAND = 0x04,
+  PCI_CFG_INTERRUPT_LINE = 0x3C,
+  PCI_CFG_INTERRUPT_PIN = 0x3D,
+
+  PCI_COMMAND_MASTER = 1 << 2,
+  PCI_COMMAND_INTX_DISABLE = 1 << 10,
+  PCI_MSI_ENABLE     = 1 << 0,
+  PCI_MSI_MULTIPLE   = 7 << 4,
+  PCI_MSI_64BIT      = 1 << 7,
+};
+
+struct idt_gate {
+  uint16_t offset_lo;
+  uint16_t selector;
+  uint8_t  zero;
+  uint8_t  type;
+  uint16_t offset_hi;
+} __attribute__((packed));
+
+struct interrupt_frame;
+
+#define IRQ_HANDLER __attribute__((interrupt, target("general-regs-only")))
+
+static struct idt_gate irq_idt[256] __attribute__((aligned(8)));
+
+static volatile uint32_t *irq_apic;
+
+static irq_handler_fn irq_fn;
+static void *irq_arg;
+
+static uint32_t irq_dev_addr;
+static unsigned irq_msi_cap;
+static int irq_pic_line = -1;
+static uint8_t irq_pic_masks[2];
+
+static void
+apic_eoi(void)
+{
+  irq_apic[APIC_EOI / 4] = 0;
+}
+
+IRQ_HANDLER static void
+irq_exception(struct interrupt_frame *frame)
+{
+  printf("Unexpected exception.\n");
+  __exit(0xbad);
+}
+
+IRQ_HANDLER static void
+irq_spurious(struct interrupt_frame *frame)
+{
+}
+
+IRQ_HANDLER static void
+irq_timer(struct interrupt_frame *frame)
+{
+  apic_eoi();
+}
+
+IRQ_HANDLER static void
+irq_doorbell(struct interrupt_frame *frame)
+{
+  apic_eoi();
+}
+
+IRQ_HANDLER static void
+irq_msi(struct interrupt_frame *frame)
+{
+  irq_fn(irq_arg);
+  apic_eoi();
+}
+
+IRQ_HANDLER static void
+irq_pic(struct interrupt_frame *frame)
+{
+  irq_fn(irq_arg);
+
+  if (irq_pic_line >= 8)
+    outb(PIC_SLAVE_CMD, PIC_EOI);
+  outb(PIC_MASTER_CMD, PIC_EOI);
+}
+
+static void
+irq_set_gate(unsigned vector, void *handler)
+{
+  uint16_t cs;
+  asm ("mov %%cs, %0" : "=r" (cs));
+
+  irq_idt[vector].offset_lo = (uint32_t)handler;
+  irq_idt[vector].selector  = cs;
+  irq_idt[vector].zero      = 0;
+  irq_idt[vector].type      = 0x8E; /* Present 32-bit interrupt gate */
+  irq_idt[vector].offset_hi = (uint32_t)handler >> 16;
+}
+
+/* Program both PICs for the given vector bases. */
+static void
+pic_remap(uint8_t master, uint8_t slave)
+{
+  outb(PIC_MASTER_CMD, 0x11);   /* ICW1: edge, cascade, ICW4 */
+  outb(PIC_SLAVE_CMD, 0x11);
+  outb(PIC_MASTER_DATA, master);
+  outb(PIC_SLAVE_DATA, slave);
+  outb(PIC_MASTER_DATA, 1 << PIC_CASCADE);
+  outb(PIC_SLAVE_DATA, PIC_CASCADE);
+  outb(PIC_MASTER_DATA, 0x01);  /* 8086 mode */
+  outb(PIC_SLAVE_DATA, 0x01);
+}
+
+bool
+irq_init(void)
+{
+  if (irq_apic)
+    return true;
+
+  if (!has_apic())
+    return false;
+
+  uint32_t hi, low;
+  asm ("rdmsr" : "=d" (hi), "=a" (low) : "c" (IA32_APIC_BASE));
+
+  if (low & APIC_X2APIC_ENABLE)
+    return false;
+
+  for (unsigned i = 0; i < 32; i++)
+    irq_set_gate(i, irq_exception);
+  irq_set_gate(VECTOR_TIMER, irq_timer);
+  irq_set_gate(VECTOR_DOORBELL, irq_doorbell);
+  irq_set_gate(VECTOR_SPURIOUS, irq_spurious);
+
+  /* Spurious PIC interrupts on IRQ 7 and 15. */
+  irq_set_gate(VECTOR_PIC_MASTER + 7, irq_spurious);
+  irq_set_gate(VECTOR_PIC_SLAVE + 7, irq_spurious);
+
+  struct {
+    uint16_t limit;
+    uint32_t base;
+  } __attribute__((packed)) idtr = { sizeof(irq_idt) - 1, (uint32_t)irq_idt };
+  asm volatile ("lidt %0" :: "m" (idtr));
+
+  irq_apic = (volatile uint32_t *)(low & APIC_PHYS_BASE_MASK);
+  apic_svr_take(irq_apic);
+  irq_apic[APIC_SVR / 4] = APIC_SVR_ENABLE | VECTOR_SPURIOUS;
+
+  /* Count the APIC timer against the PIT for 10ms. */
+  irq_apic[APIC_TIMER_DIV / 4]  = APIC_DIV_16;
+  irq_apic[APIC_LVT_TIMER / 4]  = APIC_LVT_MASKED;
+  irq_apic[APIC_TIMER_INIT / 4] = ~0U;
+  wait(10);
+  uint32_t per_ms = (~0U - irq_apic[APIC_TIMER_CUR / 4]) / 10;
+
+  if (per_ms == 0) {
+    irq_shutdown();
+    return false;
+  }
+
+  irq_apic[APIC_LVT_TIMER / 4]  = APIC_LVT_PERIODIC | VECTOR_TIMER;
+  irq_apic[APIC_TIMER_INIT / 4] = per_ms;
+
+  return true;
+}
+
+static bool
+irq_route_msi(const struct pci_device *dev)
+{
+  uint32_t addr = dev->cfg_address;
+  unsigned cap = pci_find_cap(addr, PCI_CAP_ID_MSI);
+
+  if (!cap)
+    return false;
+
+  uint16_t ctl = pci_read_uint16(addr + cap + 2);
+  unsigned data = (ctl & PCI_MSI_64BIT) ? 12 : 8;
+
+  pci_write_uint32(addr + cap + 4, MSI_ADDRESS | (irq_apic[APIC_ID / 4] >> 24) << 12);
+  if (ctl & PCI_MSI_64BIT)
+    pci_write_uint32(addr + cap + 8, 0);
+  pci_write_uint16(addr + cap + data, VECTOR_DEVICE);
+
+  irq_set_gate(VECTOR_DEVICE, irq_msi);
+  irq_msi_cap = cap;
+
+  /* MSIs are memory writes. */
+  pci_write_uint16(addr + PCI_CFG_COMMAND, pci_read_uint16(addr + PCI_CFG_COMMAND) |
+                   PCI_COMMAND_MASTER | PCI_COMMAND_INTX_DISABLE);
+  pci_write_uint16(addr + cap + 2, (ctl & ~PCI_MSI_MULTIPLE) | PCI_MSI_ENABLE);
+
+  printf("IRQ: MSI to vector %x.\n", VECTOR_DEVICE);
+  return true;
+}
+
+static bool
+irq_route_pic(const struct pci_device *dev)
+{
+  uint32_t addr = dev->cfg_address;
+  uint8_t line = pci_read_uint8(addr + PCI_CFG_INTERRUPT_LINE);
+
+  if (!pci_read_uint8(addr + PCI_CFG_INTERRUPT_PIN) || (line == 0) ||
+      (line >= 16) || (line == PIC_CASCADE))
+    return false;
+
+  irq_pic_masks[0] = inb(PIC_MASTER_DATA);
+  irq_pic_masks[1] = inb(PIC_SLAVE_DATA);
+
+  irq_pic_line = line;
+  irq_set_gate((line < 8 ? VECTOR_PIC_MASTER : VECTOR_PIC_SLAVE - 8) + line, irq_pic);
+
+  pic_remap(VECTOR_PIC_MASTER, VECTOR_PIC_SLAVE);
+  if (line < 8) {
+    outb(PIC_MASTER_DATA, ~(1 << line) & 0xFF);
+    outb(PIC_SLAVE_DATA, 0xFF);
+  } else {
+    outb(PIC_MASTER_DATA, ~(1 << PIC_CASCADE) & 0xFF);
+    outb(PIC_SLAVE_DATA, ~(1 << (line - 8)) & 0xFF);
+  }
+
+  printf("IRQ: PIC line %u.\n", line);
+  return true;
+}
+
+bool
+irq_route_pci(const struct pci_device *dev, irq_handler_fn fn, void *arg)
+{
+  if (!irq_apic)
+    return false;
+
+  irq_fn = fn;
+  irq_arg = arg;
+  irq_dev_addr = dev->cfg_address;
+
+  return irq_route_msi(dev) || irq_route_pic(dev);
+}
+
+void
+irq_wait(void)
+{
+  /* STI only takes effect after HLT, so no interrupt slips
+     through in between. */
+  asm volatile ("sti; hlt; cli" ::: "memory");
+}
+
+void
+irq_poll(void)
+{
+  /* One instruction after STI is enough for pending interrupts to
+     come in. */
+  asm volatile ("sti; nop; cli" ::: "memory");
+}
+
+void
+irq_wait_write(volatile uint32_t *word, uint32_t value)
+{
+  if (!has_monitor()) {
+    if (*word == value)
+      irq_wait();
+    return;
+  }
+
+  asm volatile ("monitor" :: "a" (word), "c" (0), "d" (0));
+
+  /* The write may have happened before we armed the monitor. */
+  if (*word != value)
+    return;
+
+  /* As with HLT, STI covers MWAIT. */
+  asm volatile ("sti; mwait; cli" :: "a" (0), "c" (0) : "memory");
+}
+
+void
+irq_shutdown(void)
+{
+  asm volatile ("cli");
+
+  if (!irq_apic)
+    return;
+
+  irq_apic[APIC_LVT_TIMER / 4]  = APIC_LVT_MASKED;
+  irq_apic[APIC_TIMER_INIT / 4] = 0;
+
+  if (irq_msi_cap) {
+    uint32_t addr = irq_dev_addr;
+
+    pci_write_uint16(addr + irq_msi_cap + 2, pci_read_uint16(addr + irq_msi_cap + 2) & ~PCI_MSI_ENABLE);
+    pci_write_uint16(addr + PCI_CFG_COMMAND, pci_read_uint16(addr + PCI_CFG_COMMAND) &
+                     ~PCI_COMMAND_INTX_DISABLE);
+    irq_msi_cap = 0;
+  }
+
+  if (irq_pic_line >= 0) {
+    pic_remap(VECTOR_BIOS_MASTER, VECTOR_BIOS_SLAVE);
+    outb(PIC_MASTER_DATA, irq_pic_masks[0]);
+    outb(PIC_SLAVE_DATA, irq_pic_masks[1]);
+    irq_pic_line = -1;
+  }
+
+  apic_svr_release(irq_apic);
+  irq_apic = NULL;
+}
+
+/* EOF */
@@ -0,0 +1,256 @@
+/* -*- Mode: C -*- */
+/*
+ * LZ4 frame decoder.
+ *
+ * Frames are decoded into one contiguous buffer, so linked blocks
+ * simply reach back into earlier output. Concatenated and skippable
+ * frames are supported, dictionaries are not.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <stddef.h>
+#include <codec.h>
+#include <tinf.h>
+
+enum {
+  LZ4_MAGIC          = 0x184D2204,
+  LZ4_SKIP_MAGIC     = 0x184D2A50,
+  LZ4_SKIP_MASK      = 0xFFFFFFF0,
+
+  LZ4_FLG_VERSION    = 3 << 6,
+  LZ4_FLG_VERSION_1  = 1 << 6,
+  LZ4_FLG_BLOCK_SUM  = 1 << 4,
+  LZ4_FLG_SIZE       = 1 << 3,
+  LZ4_FLG_SUM        = 1 << 2,
+  LZ4_FLG_DICT       = 1 << 0,
+
+  LZ4_BLOCK_RAW      = 1U << 31,
+  LZ4_MIN_MATCH      = 4,
+};
+
+static uint32_t
+lz4_le32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Reads the extension bytes of a 15 length nibble. */
+static bool
+lz4_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+  uint8_t b;
+
+  do {
+    if (*ip >= end)
+      return false;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+
+  return true;
+}
+
+/**
+ * Decode one block. With op == NULL, only count the output. base is
+ * where the output of the current frame starts.
+ */
+static bool
+lz4_block(uint8_t *base, uint8_t **opp, uint8_t *oend, size_t *count,
+          const uint8_t *ip, size_t len)
+{
+  const uint8_t *iend = ip + len;
+  uint8_t *op = *opp;
+
+  for (;;) {
+    uint8_t token;
+    size_t lit, mlen, offset;
+
+    if (ip >= iend)
+      return false;
+    token = *ip++;
+
+    lit = token >> 4;
+    if ((lit == 15) && !lz4_length(&ip, iend, &lit))
+      return false;
+
+    if ((size_t)(iend - ip) < lit)
+      return false;
+
+    if (op) {
+      if ((size_t)(oend - op) < lit)
+        return false;
+      __builtin_memcpy(op, ip, lit);
+      op += lit;
+    }
+    *count += lit;
+    ip += lit;
+
+    /* The last sequence has only literals. */
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return false;
+    offset = ip[0] | ip[1] << 8;
+    ip += 2;
+
+    mlen = token & 15;
+    if ((mlen == 15) && !lz4_length(&ip, iend, &mlen))
+      return false;
+    mlen += LZ4_MIN_MATCH;
+
+    if (op) {
+      if ((offset == 0) || (offset > (size_t)(op - base)) ||
+          ((size_t)(oend - op) < mlen))
+        return false;
+
+      const uint8_t *match = op - offset;
+
+      /* Overlapping matches repeat the last offset bytes. */
+      if (offset >= 4) {
+        for (; mlen >= 4; mlen -= 4, op += 4, match += 4)
+          __builtin_memcpy(op, match, 4);
+      }
+      for (; mlen; mlen--)
+        *op++ = *match++;
+    } else
+      *count += mlen;
+  }
+
+  *opp = op;
+  return true;
+}
+
+/**
+ * Decompress LZ4 frames. If dest is NULL, return the uncompressed
+ * length in *destLen. This uses the content size in the frame header
+ * if there is one and counts the output of all blocks otherwise.
+ */
+int
+lz4_uncompress(void *dest, unsigned int *destLen,
+               const void *source, unsigned int sourceLen)
+{
+  const uint8_t *ip = source;
+  const uint8_t *iend = ip + sourceLen;
+  uint8_t *op = dest;
+  uint8_t *oend = dest ? op + *destLen : NULL;
+  size_t total = 0;
+
+  while (ip < iend) {
+    if (iend - ip < 8)
+      return TINF_DATA_ERROR;
+
+    uint32_t magic = lz4_le32(ip);
+
+    if ((magic & LZ4_SKIP_MASK) == LZ4_SKIP_MAGIC) {
+      uint32_t skip = lz4_le32(ip + 4);
+      if ((size_t)(iend - ip - 8) < skip)
+        return TINF_DATA_ERROR;
+      ip += 8 + skip;
+      continue;
+    }
+
+    if (magic != LZ4_MAGIC)
+      return TINF_DATA_ERROR;
+
+    const uint8_t *desc = ip + 4;
+    uint8_t flg = desc[0];
+    size_t dlen = 2 + ((flg & LZ4_FLG_SIZE) ? 8 : 0) + ((flg & LZ4_FLG_DICT) ? 4 : 0);
+
+    if (((flg & LZ4_FLG_VERSION) != LZ4_FLG_VERSION_1) || (flg & LZ4_FLG_DICT))
+      return TINF_DATA_ERROR;
+
+    if ((size_t)(iend - desc) < dlen + 1)
+      return TINF_DATA_ERROR;
+
+    if (((xxh32(desc, dlen, 0) >> 8) & 0xFF) != desc[dlen])
+      return TINF_DATA_ERROR;
+
+    ip = desc + dlen + 1;
+
+    /* Sizes can be told from the header, if the frame has one. Keep
+       it, the output may overwrite the header when decompressing in
+       place. */
+    uint32_t content = 0;
+
+    if (flg & LZ4_FLG_SIZE) {
+      if (lz4_le32(desc + 6))
+        return TINF_DATA_ERROR;
+      content = lz4_le32(desc + 2);
+      if (!dest)
+        total += content;
+    }
+
+    uint8_t *base = op;
+    size_t count = 0;
+
+    for (;;) {
+      if (iend - ip < 4)
+        return TINF_DATA_ERROR;
+
+      uint32_t bsize = lz4_le32(ip);
+      ip += 4;
+
+      if (bsize == 0)
+        break;
+
+      bool raw = bsize & LZ4_BLOCK_RAW;
+      bsize &= ~LZ4_BLOCK_RAW;
+
+      if ((size_t)(iend - ip) < bsize + ((flg & LZ4_FLG_BLOCK_SUM) ? 4 : 0))
+        return TINF_DATA_ERROR;
+
+      if (dest && (flg & LZ4_FLG_BLOCK_SUM) &&
+          (xxh32(ip, bsize, 0) != lz4_le32(ip + bsize)))
+        return TINF_DATA_ERROR;
+
+      if (!dest && (flg & LZ4_FLG_SIZE)) {
+        /* Already counted. */
+      } else if (raw) {
+        if (dest) {
+          if ((size_t)(oend - op) < bsize)
+            return TINF_DATA_ERROR;
+          __builtin_memcpy(op, ip, bsize);
+          op += bsize;
+        }
+        count += bsize;
+      } else if (!lz4_block(base, &op, oend, &count, ip, bsize))
+        return TINF_DATA_ERROR;
+
+      ip += bsize + ((flg & LZ4_FLG_BLOCK_SUM) ? 4 : 0);
+    }
+
+    if (flg & LZ4_FLG_SUM) {
+      if (iend - ip < 4)
+        return TINF_DATA_ERROR;
+      if (dest && (xxh32(base, op - base, 0) != lz4_le32(ip)))
+        return TINF_DATA_ERROR;
+      ip += 4;
+    }
+
+    if (dest && (flg & LZ4_FLG_SIZE) && (content != (size_t)(op - base)))
+      return TINF_DATA_ERROR;
+
+    if (dest)
+      total += op - base;
+    else if (!(flg & LZ4_FLG_SIZE))
+      total += count;
+  }
+
+  *destLen = total;
+  return TINF_OK;
+}
+
+/* EOF */
@@ -3,9 +3,86 @@
 #include <mbi.h>
 #include <stddef.h>
 #include <util.h>
+#include <cpuid.h>
+#include <smp.h>
 #include <tinf.h>
+#include <codec.h>
 
 
+enum {
+  MBI_MAX_RESERVED = 64,
+};
+
+/* Memory that is in use although the memory map says it is free,
+   like kernel segments that are already in place. */
+static struct {
+  uint64_t start;
+  uint64_t end;
+} mbi_reserved[MBI_MAX_RESERVED];
+static unsigned mbi_reserved_count;
+
+/** Keep mbi_find_memory() away from [start, end). The memory map is
+    left alone, as the OS is free to use this memory. */
+void
+mbi_reserve_range(uintptr_t start, uintptr_t end)
+{
+  if (start >= end)
+    return;
+
+  /* When the table is full, the last range grows to cover the new
+     one. That wastes memory, but never hands out any in use. */
+  if (mbi_reserved_count == MBI_MAX_RESERVED) {
+    mbi_reserved[MBI_MAX_RESERVED - 1].start = MIN(mbi_reserved[MBI_MAX_RESERVED - 1].start, (uint64_t)start);
+    mbi_reserved[MBI_MAX_RESERVED - 1].end   = MAX(mbi_reserved[MBI_MAX_RESERVED - 1].end, (uint64_t)end);
+    return;
+  }
+
+  mbi_reserved[mbi_reserved_count].start = start;
+  mbi_reserved[mbi_reserved_count].end   = end;
+  mbi_reserved_count++;
+}
+
+/**
+ * Find the highest (or lowest) page aligned piece of [start, end) that
+ * is at least len bytes long and clear of reserved ranges. Pieces
+ * begin at start or behind a reserved range.
+ */
+static bool
+free_piece(uint64_t start, uint64_t end, size_t len, bool highest,
+           uint64_t *piece_start, uint64_t *piece_end)
+{
+  bool found = false;
+
+  for (unsigned i = 0; i <= mbi_reserved_count; i++) {
+    uint64_t pstart = (i == mbi_reserved_count) ? start : mbi_reserved[i].end;
+    uint64_t pend   = end;
+    bool reserved   = (pstart < start) || (pstart >= end);
+
+    for (unsigned j = 0; j < mbi_reserved_count; j++) {
+      if ((mbi_reserved[j].start <= pstart) && (pstart < mbi_reserved[j].end))
+        reserved = true;
+      else if (mbi_reserved[j].start > pstart)
+        pend = MIN(pend, mbi_reserved[j].start);
+    }
+
+    /* Memory blocks may not be page aligned. Round length and
+       address to page granularity. */
+    pstart = (pstart + 0xFFF) & ~0xFFFULL;
+    pend  &= ~0xFFFULL;
+
+    if (reserved || (pend < pstart) || (pend - pstart < len))
+      continue;
+
+    if (!found || (highest ? (pstart > *piece_start) : (pstart < *piece_start))) {
+      found = true;
+      *piece_start = pstart;
+      *piece_end   = pend;
+    }
+  }
+
+  return found;
+}
+
 /** Find a sufficiently large block of free memory that is page aligned.
  */
 bool
@@ -17,35 +94,28 @@ mbi_find_memory(const struct mbi *multiboot_info, size_t len,
   size_t mmap_len    = multiboot_info->mmap_length;
   memory_map_t *mmap = (memory_map_t *)multiboot_info->mmap_addr;
 
-  while ((uint32_t)mmap < multiboot_info->mmap_addr + mmap_len) {
+  for (; (uint32_t)mmap < multiboot_info->mmap_addr + mmap_len;
+       mmap = (memory_map_t *)(mmap->size + (uint32_t)mmap + sizeof(mmap->size))) {
     uint64_t block_len  = (uint64_t)mmap->length_high<<32 | mmap->length_low;
     uint64_t block_addr = (uint64_t)mmap->base_addr_high<<32 | mmap->base_addr_low;
+    uint64_t piece_start = 0, piece_end = 0;
 
-    /* Memory blocks may not be page aligned. Round length and address
-       to page granularity. */
-    uint64_t nblock_addr = (block_addr + 0xFFF) & ~0xFFF;
-    if (nblock_addr > (block_addr + block_len)) continue;
-    block_len -= (nblock_addr - block_addr);
-    block_len  = block_len & ~0xFFF;
-    block_addr = nblock_addr;
+    /* Only what is below 4GB is of use to us. */
+    if ((mmap->type != MMAP_AVAILABLE) || ((block_addr >> 32) != 0ULL) ||
+        !free_piece(block_addr, MIN(block_addr + block_len, 1ULL << 32), len, highest,
+                    &piece_start, &piece_end))
+      continue;
 
-    if ((mmap->type == MMAP_AVAILABLE) && ((block_addr >> 32) == 0ULL) &&
-        (block_len >= len)) {
+    if ((found == true) && ((uintptr_t)*block_start_out > piece_start))
+      continue;
 
-      if ((found == true) && ((uintptr_t)*block_start_out > block_addr))
-        continue;
-
-      found = true;
-      *block_start_out = (void *)(uintptr_t)block_addr;
-      *block_len_out   = (size_t)block_len;
+    found = true;
+    *block_start_out = (void *)(uintptr_t)piece_start;
+    *block_len_out   = (size_t)(piece_end - piece_start);
 
-      if (!highest) return true;
-    }
-  
-    /* Skip to next entry. */
-    mmap = (memory_map_t *)(mmap->size + (uint32_t)mmap + sizeof(mmap->size));
+    if (!highest) return true;
   }
-  
+
   return found;
 }
 
@@ -86,17 +156,317 @@ mbi_alloc_protected_memory(struct mbi *multiboot_info, size_t len, unsigned alig
 }
 
 
+enum {
+  GZIP_FEXTRA = 4,
+  GZIP_SLICES = 16,             /* Jobs per multi-member module */
+};
+
 /**
- * Returns true of module is compressed and can be inflated. Inflated
- * size is returned in uncompressed.
+ * Returns the length of the gzip member at p from its BGZF size hint
+ * (the BC subfield in FEXTRA, as written by bgzip) or zero, if there
+ * is none.
+ */
+size_t
+gzip_member_len(const uint8_t *p, size_t len)
+{
+  if ((len < 18) || (p[0] != 0x1f) || (p[1] != 0x8b) || (p[2] != 8) ||
+      !(p[3] & GZIP_FEXTRA))
+    return 0;
+
+  size_t xlen = p[10] | p[11] << 8;
+  if (12 + xlen > len)
+    return 0;
+
+  const uint8_t *end = p + 12 + xlen;
+  for (const uint8_t *sub = p + 12; sub + 4 <= end; sub += 4 + (sub[2] | sub[3] << 8)) {
+    if ((sub[0] == 'B') && (sub[1] == 'C') && ((sub[2] | sub[3] << 8) == 2) &&
+        (sub + 6 <= end)) {
+      size_t mlen = (sub[4] | sub[5] << 8) + 1;
+      return ((mlen >= 12 + xlen + 8) && (mlen <= len)) ? mlen : 0;
+    }
+  }
+
+  return 0;
+}
+
+/** Returns the inflated size from the trailer of a gzip member. */
+static uint32_t
+gzip_member_isize(const uint8_t *p, size_t mlen)
+{
+  return p[mlen - 4] | p[mlen - 3] << 8 | p[mlen - 2] << 16 | (uint32_t)p[mlen - 1] << 24;
+}
+
+/**
+ * Returns true of module is compressed and can be inflated. The
+ * format is recognized by its magic bytes and its codec returned in
+ * codec. Inflated size is returned in uncompressed. Modules made of
+ * several gzip members with size hints return their count in members,
+ * these can be inflated in parallel.
  */
 static bool
-gzip_info(struct module *mod, size_t *uncompressed)
+module_info(struct module *mod, const struct codec **codec,
+            size_t *uncompressed, unsigned *members)
 {
-  int ret = tinf_gzip_uncompress(NULL, uncompressed,
+  const uint8_t *p = (const uint8_t *)mod->mod_start;
+  size_t len = mod->mod_end - mod->mod_start;
+  size_t mlen, total = 0;
+  unsigned n = 0;
+
+  *members = 1;
+  *codec = codec_detect(p, len);
+  if (!*codec)
+    return false;
+
+  for (; len && (mlen = gzip_member_len(p, len)); p += mlen, len -= mlen, n++)
+    total += gzip_member_isize(p, mlen);
+
+  if ((len == 0) && (n > 1)) {
+    *uncompressed = total;
+    *members = n;
+    return true;
+  }
+
+  /* Anything else has to be a single gzip member or a file the codec
+     can tell the size of. */
+  int ret = (*codec)->uncompress(NULL, uncompressed,
                                  (void *)mod->mod_start,
                                  mod->mod_end - mod->mod_start);
-  return (ret == TINF_OK);    
+  return (ret == TINF_OK);
+}
+
+struct module_reloc {
+  size_t modlen;
+  size_t slen;
+  size_t inflated_size;
+  bool   do_inflate;
+  unsigned members;
+  const struct codec *codec;
+
+  size_t region;                /* Page aligned, including the string */
+  size_t inplace_region;        /* Same for in-place decompression */
+
+  const uint8_t *source;
+  char *target;
+};
+
+/* A whole module or a slice of gzip members of one. */
+struct module_job {
+  struct module_reloc *m;
+  const uint8_t *source;
+  size_t source_len;
+  size_t offset;                /* In the module's target */
+  size_t len;                   /* Expected output */
+
+  int res;
+  size_t produced;
+};
+
+/**
+ * Inflate or copy a single job. Runs on any processor.
+ */
+static void
+relocate_job(unsigned index, void *arg)
+{
+  struct module_job *job = ((struct module_job **)arg)[index];
+  char *target = job->m->target + job->offset;
+
+  job->res = TINF_OK;
+  job->produced = 0;
+
+  if (!job->m->do_inflate) {
+    /* In place, the source is only shifted a little. */
+    memmove(target, job->source, job->source_len);
+    job->produced = job->source_len;
+    return;
+  }
+
+  for (const uint8_t *p = job->source, *end = p + job->source_len; p < end;) {
+    size_t mlen = (job->m->members > 1) ? gzip_member_len(p, end - p) : (size_t)(end - p);
+    size_t out = job->len - job->produced;
+
+    job->res = job->m->codec->uncompress(target + job->produced, &out, p, mlen);
+    if ((mlen == 0) || (job->res != TINF_OK)) {
+      job->res = TINF_DATA_ERROR;
+      return;
+    }
+
+    job->produced += out;
+    p += mlen;
+  }
+}
+
+enum {
+  INPLACE_SLACK = 128 << 10,
+};
+
+/**
+ * How much room in-place decompression needs beyond the inflated
+ * size, so that the output never catches up with the input still to
+ * be read. zstd decodes literals up to one 128K block ahead of its
+ * output. The rest covers headers and stored blocks, which grow the
+ * data a little.
+ */
+static size_t
+inplace_margin(size_t inflated)
+{
+  return (inflated >> 8) + INPLACE_SLACK;
+}
+
+extern const char _image_start[], _image_end[];
+
+static bool
+overlaps(uintptr_t start, uintptr_t end, uintptr_t ostart, uintptr_t oend)
+{
+  return (start < oend) && (ostart < end);
+}
+
+/**
+ * Returns true if [start, end) overlaps anything we need until the
+ * OS runs: our own image, the multiboot info, the module list, the
+ * module strings or the memory map. Module data does not count.
+ */
+bool
+mbi_overlaps_boot_data(const struct mbi *mbi, uintptr_t start, uintptr_t end)
+{
+  const struct module *mods = (const struct module *)mbi->mods_addr;
+
+  if (overlaps(start, end, (uintptr_t)_image_start, (uintptr_t)_image_end) ||
+      overlaps(start, end, (uintptr_t)mbi, (uintptr_t)(mbi + 1)) ||
+      overlaps(start, end, mbi->mods_addr, (uintptr_t)(mods + mbi->mods_count)) ||
+      ((mbi->flags & MBI_FLAG_MMAP) &&
+       overlaps(start, end, mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length)))
+    return true;
+
+  for (unsigned i = 0; i < mbi->mods_count; i++) {
+    uintptr_t string = mods[i].string;
+    if (overlaps(start, end, string, string + strlen((const char *)string) + 1))
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * Find len bytes of memory nothing needs until the OS runs: no boot
+ * data, no module and nothing below 1MB. The highest such memory is
+ * reserved and returned. Returns NULL, if there is none.
+ */
+void *
+mbi_alloc_scratch(const struct mbi *mbi, size_t len)
+{
+  const struct module *mods = (const struct module *)mbi->mods_addr;
+  unsigned reserved = mbi_reserved_count;
+  void *block;
+  size_t block_len;
+
+  /* What is in use is only reserved for the search. Without room
+     for all of it, we do without. */
+  if (reserved + 5 + 2 * mbi->mods_count > MBI_MAX_RESERVED)
+    return NULL;
+
+  mbi_reserve_range(0, 1 << 20);
+  mbi_reserve_range((uintptr_t)_image_start, (uintptr_t)_image_end);
+  mbi_reserve_range((uintptr_t)mbi, (uintptr_t)(mbi + 1));
+  mbi_reserve_range(mbi->mods_addr, (uintptr_t)(mods + mbi->mods_count));
+  if (mbi->flags & MBI_FLAG_MMAP)
+    mbi_reserve_range(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+
+  for (unsigned i = 0; i < mbi->mods_count; i++) {
+    uintptr_t string = mods[i].string;
+
+    mbi_reserve_range(mods[i].mod_start, mods[i].mod_end);
+    mbi_reserve_range(string, string + strlen((const char *)string) + 1);
+  }
+
+  len = (len + 0xFFF) & ~0xFFF;
+  bool found = mbi_find_memory(mbi, len, &block, &block_len, true);
+  mbi_reserved_count = reserved;
+
+  if (!found)
+    return NULL;
+
+  uintptr_t start = (uintptr_t)block + block_len - len;
+  mbi_reserve_range(start, start + len);
+  return (void *)start;
+}
+
+/**
+ * Returns true if [start, end) lies within one available entry of the
+ * memory map, overlaps no other entry and nothing reserved. Memory
+ * taken by mbi_alloc_protected_memory() is no longer available.
+ */
+bool
+mbi_memory_available(const struct mbi *mbi, uintptr_t start, uintptr_t end)
+{
+  bool inside = false;
+
+  if (start >= end)
+    return true;
+  if (!(mbi->flags & MBI_FLAG_MMAP))
+    return false;
+
+  for (memory_map_t *mmap = (memory_map_t *)mbi->mmap_addr;
+       (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+       mmap = (memory_map_t *)(mmap->size + (uint32_t)mmap + sizeof(mmap->size))) {
+    uint64_t block_len  = (uint64_t)mmap->length_high<<32 | mmap->length_low;
+    uint64_t block_addr = (uint64_t)mmap->base_addr_high<<32 | mmap->base_addr_low;
+
+    if ((mmap->type == MMAP_AVAILABLE) && (block_addr <= start) &&
+        (end <= block_addr + block_len))
+      inside = true;
+    else if ((start < block_addr + block_len) && (block_addr < end))
+      return false;
+  }
+
+  for (unsigned i = 0; i < mbi_reserved_count; i++)
+    if ((start < mbi_reserved[i].end) && (mbi_reserved[i].start < end))
+      return false;
+
+  return inside;
+}
+
+/**
+ * Check whether all modules can be relocated in place into
+ * [start, end). Only the modules themselves may be in the way there
+ * and they have to be in the same order as their targets.
+ */
+static bool
+inplace_possible(const struct mbi *mbi, uintptr_t start, uintptr_t end)
+{
+  const struct module *mods = (const struct module *)mbi->mods_addr;
+
+  if (mbi_overlaps_boot_data(mbi, start, end))
+    return false;
+
+  for (unsigned i = 1; i < mbi->mods_count; i++)
+    if (mods[i - 1].mod_end > mods[i].mod_start)
+      return false;
+
+  return true;
+}
+
+/**
+ * Move each module to the tail of its target, from where it is
+ * inflated forward. Modules that move down go first, lowest first,
+ * then the ones that move up, highest first. This way no module
+ * lands on one that has not moved yet.
+ */
+static void
+inplace_move(const struct mbi *mbi, struct module_reloc *minfo)
+{
+  const struct module *mods = (const struct module *)mbi->mods_addr;
+  unsigned count = mbi->mods_count;
+
+  for (unsigned i = 0; i < count; i++)
+    minfo[i].source = (const uint8_t *)minfo[i].target + minfo[i].inplace_region - minfo[i].modlen;
+
+  for (unsigned i = 0; i < count; i++)
+    if (minfo[i].source < (const uint8_t *)mods[i].mod_start)
+      memmove((void *)minfo[i].source, (void *)mods[i].mod_start, minfo[i].modlen);
+
+  for (int i = count - 1; i >= 0; i--)
+    if (minfo[i].source > (const uint8_t *)mods[i].mod_start)
+      memmove((void *)minfo[i].source, (void *)mods[i].mod_start, minfo[i].modlen);
 }
 
 /**
@@ -104,46 +474,75 @@ gzip_info(struct module *mod, size_t *uncompressed)
  * somewhat EXPERIMENTAL. If uncompress is true, we transparently
  * uncompress all modules. If uncompress is set and relocation fails,
  * we consider this as fatal error (panic).
+ *
+ * If there is no room for the relocated modules next to the original
+ * ones, we relocate them in place: Every module is moved to the end
+ * of its target and inflated from there, so the target only has to
+ * be somewhat larger than the bigger of both.
  */
 void
 mbi_relocate_modules(struct mbi *mbi, bool uncompress)
 {
-  size_t size = 0;
-  bool need_inflate = false;
+  size_t size = 0, inplace_size = 0;
+  bool need_inflate = false, parallel = mbi->mods_count > 1;
 
-  if (uncompress)
+  if (uncompress) {
+    /* tinf's checksums want SSE. */
+    enable_sse();
     tinf_init();
+  }
 
   struct module *mods = (struct module *)mbi->mods_addr;
-  struct { 
-    size_t modlen;
-    size_t slen;
-    size_t inflated_size;
-    bool   do_inflate;
-  } minfo[mbi->mods_count];
+  struct module_reloc minfo[mbi->mods_count];
 
   for (unsigned i = 0; i < mbi->mods_count; i++) {
 
     minfo[i].modlen = mods[i].mod_end - mods[i].mod_start;
     minfo[i].slen   = strlen((const char *)mods[i].string) + 1;
+    minfo[i].source = (const uint8_t *)mods[i].mod_start;
 
-    minfo[i].do_inflate = uncompress && gzip_info(&mods[i], &minfo[i].inflated_size);
+    minfo[i].do_inflate = uncompress && module_info(&mods[i], &minfo[i].codec,
+                                                    &minfo[i].inflated_size,
+                                                    &minfo[i].members);
     if (minfo[i].do_inflate)
       need_inflate = true;
+    else
+      minfo[i].members = 1;
+
+    if (minfo[i].members > 1)
+      parallel = true;
 
-    size += minfo[i].do_inflate ? minfo[i].inflated_size : minfo[i].modlen;
-    size += minfo[i].slen;
+    size_t target_len = minfo[i].do_inflate ? minfo[i].inflated_size : minfo[i].modlen;
+    size_t inplace_len = target_len;
+
+    if (minfo[i].do_inflate)
+      inplace_len = MAX(target_len + inplace_margin(target_len), minfo[i].modlen);
 
     /* Round up to page size */
-    size = (size + 0xFFF) & ~0xFFF;
+    minfo[i].region = (minfo[i].slen + 1 + target_len + 0xFFF) & ~0xFFF;
+    minfo[i].inplace_region = (minfo[i].slen + 1 + inplace_len + 0xFFF) & ~0xFFF;
+
+    size += minfo[i].region;
+    inplace_size += minfo[i].inplace_region;
+  }
+
+  /* The other processors take their stacks from free memory, so they
+     come up before we pick the targets. */
+  if (need_inflate && parallel) {
+    unsigned aps = smp_init(mbi);
+    if (aps)
+      printf("Using %u additional CPUs.\n", aps);
   }
 
   void *block;
   size_t block_len;
+  uintptr_t reladdr = 0;
+  bool found = false, in_place = false;
 
   if (mbi_find_memory(mbi, size, &block, &block_len, true)) {
     /* Check for overlap */
-    uintptr_t reladdr = (uintptr_t)block + block_len - size;
+    reladdr = (uintptr_t)block + block_len - size;
+    found = true;
     for (unsigned i = 0; i < mbi->mods_count; i++) {
       if (mods[i].mod_end > reladdr) {
         if (reladdr == mods[i].mod_start) {
@@ -152,45 +551,119 @@ mbi_relocate_modules(struct mbi *mbi, bool uncompress)
         } else {
           printf("Modules might overlap.\nRelocate to %p, but module at %8x-%8x.\n",
                  reladdr, mods[i].mod_start, mods[i].mod_end-1);
-          goto fail;
+          found = false;
+          break;
         }
       }
     }
+  }
 
-    printf("Need %8x bytes to relocate modules.\n", size);
-    printf("Relocating to %8x: \n", reladdr);
-
-    for (int i = mbi->mods_count - 1; i >= 0; i--) {
-      size_t target_len = minfo[i].do_inflate ? minfo[i].inflated_size : minfo[i].modlen;
-      block_len -= (minfo[i].slen + 1 + target_len + 0xFFF) & ~0xFFF;
-    
-      if (minfo[i].do_inflate) {
-        size_t uncompressed;
-        printf("Inflating %u -> %u bytes...\n", minfo[i].modlen, target_len);
-        int res = tinf_gzip_uncompress((char *)block + block_len, &uncompressed,
-                                       (void *)mods[i].mod_start, minfo[i].modlen);
-        assert((res == TINF_OK) && (uncompressed == target_len),
-               "Error decompressing data.");
-      } else {
-        printf("Copying %u bytes...\n", minfo[i].modlen);
-        memcpy((char *)block + block_len, (void *)mods[i].mod_start,
-               minfo[i].modlen);
-      }
-      mods[i].mod_start = (size_t)((char *)block + block_len);
-      mods[i].mod_end = mods[i].mod_start + target_len;
-
-      memcpy((char *)block + block_len + target_len, 
-             (void *)mods[i].string, minfo[i].slen + 1);
-      mods[i].string = (uintptr_t)((char *)block + block_len + target_len);
+  if (!found && mbi_find_memory(mbi, inplace_size, &block, &block_len, true)) {
+    reladdr = (uintptr_t)block + block_len - inplace_size;
+    found = in_place = inplace_possible(mbi, reladdr, reladdr + inplace_size);
+    if (in_place) {
+      printf("Relocating in place instead.\n");
+      size = inplace_size;
     }
-    printf("\n");
+  }
 
-  } else {
-  fail:
+  if (!found) {
     printf("Cannot relocate.\n");
   silent_fail:
+    smp_park();
     assert(!need_inflate, "Couldn't relocate, which is required for decompressing.");
+    return;
+  }
+
+  printf("Need %8x bytes to relocate modules.\n", size);
+  printf("Relocating to %8x: \n", reladdr);
+
+  unsigned njobs = 0;
+
+  for (int i = mbi->mods_count - 1; i >= 0; i--) {
+    block_len -= in_place ? minfo[i].inplace_region : minfo[i].region;
+    minfo[i].target = (char *)block + block_len;
+
+    /* Members of a module inflated in place have to go one after
+       the other. */
+    njobs += in_place ? 1 : MIN(minfo[i].members, (unsigned)GZIP_SLICES);
+  }
+
+  if (in_place)
+    inplace_move(mbi, minfo);
+
+  struct module_job jobs[njobs];
+  struct module_job *order[njobs];
+  unsigned n = 0;
+
+  for (int i = mbi->mods_count - 1; i >= 0; i--) {
+    size_t target_len = minfo[i].do_inflate ? minfo[i].inflated_size : minfo[i].modlen;
+
+    if (minfo[i].members > 1)
+      printf("Inflating %u -> %u bytes (%s, %u members)...\n", minfo[i].modlen,
+             target_len, minfo[i].codec->name, minfo[i].members);
+    else if (minfo[i].do_inflate)
+      printf("Inflating %u -> %u bytes (%s)...\n", minfo[i].modlen, target_len,
+             minfo[i].codec->name);
+    else
+      printf("Copying %u bytes...\n", minfo[i].modlen);
+
+    /* Cut multi-member modules into slices of whole members. Each
+       slice knows where its output goes from the member trailers. */
+    const uint8_t *p = minfo[i].source;
+    const uint8_t *end = p + minfo[i].modlen;
+    unsigned slices = in_place ? 1 : MIN(minfo[i].members, (unsigned)GZIP_SLICES);
+    size_t offset = 0;
+
+    for (unsigned s = 0, member = 0; s < slices; s++) {
+      struct module_job *job = &jobs[n];
+
+      job->m = &minfo[i];
+      job->source = p;
+      job->offset = offset;
+
+      if (minfo[i].members == 1) {
+        p = end;
+        offset = target_len;
+      } else {
+        for (; member < (s + 1) * minfo[i].members / slices; member++) {
+          size_t mlen = gzip_member_len(p, end - p);
+          offset += gzip_member_isize(p, mlen);
+          p += mlen;
+        }
+      }
+
+      job->source_len = p - job->source;
+      job->len = offset - job->offset;
+
+      /* Largest jobs first, they bound the total time. */
+      unsigned j;
+      for (j = n++; (j > 0) && (order[j - 1]->source_len < job->source_len); j--)
+        order[j] = order[j - 1];
+      order[j] = job;
+    }
+  }
+
+  /* The targets overlap neither each other nor any source, except for
+     their own when inflating in place, so all jobs can run at once. */
+  smp_for_each(njobs, relocate_job, order);
+  smp_park();
+
+  for (unsigned j = 0; j < njobs; j++)
+    assert((jobs[j].res == TINF_OK) && (jobs[j].produced == jobs[j].len),
+           "Error decompressing data.");
+
+  for (unsigned i = 0; i < mbi->mods_count; i++) {
+    size_t target_len = minfo[i].do_inflate ? minfo[i].inflated_size : minfo[i].modlen;
+
+    mods[i].mod_start = (size_t)minfo[i].target;
+    mods[i].mod_end = mods[i].mod_start + target_len;
+
+    memcpy((char *)minfo[i].target + target_len,
+           (void *)mods[i].string, minfo[i].slen + 1);
+    mods[i].string = (uintptr_t)((char *)minfo[i].target + target_len);
   }
+  printf("\n");
 }
 
 
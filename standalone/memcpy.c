@@ -1,12 +1,100 @@
 /* -*- Mode: C -*- */
 
 #include <util.h>
+#include <memops.h>
+
+/* All variants copy forward, so they also work for overlapping
+   buffers if dest is below src. memmove() relies on this. */
 
 void *
 memcpy(void *dest, const void *src, size_t n)
+{
+  return ((n < MEM_STREAM_MIN) ? mem_ops.copy : mem_ops.copy_large)(dest, src, n);
+}
+
+void *
+memcpy_movsb(void *dest, const void *src, size_t n)
 {
   char *d = dest;
   const char *s = src;
   asm volatile  ("rep movsb" : "+D" (d), "+S" (s) , "+c" (n) : : "memory");
   return dest;
 }
+
+void *
+memcpy_movsd(void *dest, const void *src, size_t n)
+{
+  char *d = dest;
+  const char *s = src;
+
+  if (n >= 16) {
+    /* Align the target. */
+    size_t head = -(uintptr_t)d & 3;
+    size_t words = (n - head) / 4;
+
+    n -= head + words * 4;
+    asm volatile  ("rep movsb" : "+D" (d), "+S" (s) , "+c" (head) : : "memory");
+    asm volatile  ("rep movsl" : "+D" (d), "+S" (s) , "+c" (words) : : "memory");
+  }
+
+  asm volatile  ("rep movsb" : "+D" (d), "+S" (s) , "+c" (n) : : "memory");
+  return dest;
+}
+
+/* Copy 64 byte blocks with SSE2 to a 16 byte aligned target. Store
+   is movdqa or movntdq. blocks must not be zero. */
+#define COPY_BLOCKS(store, d, s, blocks)                                \
+  asm volatile ("1: movdqu   (%1), %%xmm0\n"                            \
+                "   movdqu 16(%1), %%xmm1\n"                            \
+                "   movdqu 32(%1), %%xmm2\n"                            \
+                "   movdqu 48(%1), %%xmm3\n"                            \
+                "   " store " %%xmm0,   (%0)\n"                         \
+                "   " store " %%xmm1, 16(%0)\n"                         \
+                "   " store " %%xmm2, 32(%0)\n"                         \
+                "   " store " %%xmm3, 48(%0)\n"                         \
+                "   add $64, %0\n"                                      \
+                "   add $64, %1\n"                                      \
+                "   dec %2\n"                                           \
+                "   jnz 1b\n"                                           \
+                : "+r" (d), "+r" (s), "+r" (blocks)                     \
+                :: "memory", "xmm0", "xmm1", "xmm2", "xmm3")
+
+__attribute__((target("sse2")))
+static void *
+memcpy_sse2_common(void *dest, const void *src, size_t n, bool stream)
+{
+  char *d = dest;
+  const char *s = src;
+
+  if (n >= MEM_SSE2_MIN) {
+    size_t head = -(uintptr_t)d & 15;
+    size_t blocks = (n - head) / 64;
+
+    n -= head + blocks * 64;
+    asm volatile  ("rep movsb" : "+D" (d), "+S" (s) , "+c" (head) : : "memory");
+
+    if (stream) {
+      COPY_BLOCKS("movntdq", d, s, blocks);
+      asm volatile ("sfence" ::: "memory");
+    } else
+      COPY_BLOCKS("movdqa ", d, s, blocks);
+  }
+
+  asm volatile  ("rep movsb" : "+D" (d), "+S" (s) , "+c" (n) : : "memory");
+  return dest;
+}
+
+void *
+memcpy_sse2(void *dest, const void *src, size_t n)
+{
+  return memcpy_sse2_common(dest, src, n, false);
+}
+
+/** Same with non-temporal stores, which do not pollute the cache. */
+void *
+memcpy_stream(void *dest, const void *src, size_t n)
+{
+  return memcpy_sse2_common(dest, src, n, true);
+}
+
+/* EOF */
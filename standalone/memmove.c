@@ -0,0 +1,124 @@
+/* -*- Mode: C -*- */
+
+#include <util.h>
+#include <memops.h>
+
+/* The backward variants are for a dest that overlaps the end of
+   src. Fast strings only work forward, so there is no REP MOVSB
+   variant. Like in gen_copy(), the end of the target is aligned. */
+
+void *
+memmove(void *dest, const void *src, size_t n)
+{
+  char *d = dest;
+  const char *s = src;
+
+  if ((d <= s) || (d >= s + n))
+    return memcpy(dest, src, n);
+
+  /* dest overlaps the end of src. Copy backwards. */
+  return ((n < MEM_STREAM_MIN) ? mem_ops.move_back : mem_ops.move_back_large)(dest, src, n);
+}
+
+/* Copy n bytes or words backwards, which end at d and s. */
+static inline void
+movsb_back(char *d, const char *s, size_t n)
+{
+  d--; s--;
+  asm volatile  ("std; rep movsb; cld" : "+D" (d), "+S" (s) , "+c" (n) : : "memory");
+}
+
+static inline void
+movsd_back(char *d, const char *s, size_t words)
+{
+  d -= 4; s -= 4;
+  asm volatile  ("std; rep movsl; cld" : "+D" (d), "+S" (s) , "+c" (words) : : "memory");
+}
+
+void *
+memmove_back_movsd(void *dest, const void *src, size_t n)
+{
+  char *d = (char *)dest + n;
+  const char *s = (const char *)src + n;
+
+  if (n >= 16) {
+    /* Align the end of the target. */
+    size_t tail = (uintptr_t)d & 3;
+    size_t words = (n - tail) / 4;
+
+    movsb_back(d, s, tail);
+    d -= tail;
+    s -= tail;
+
+    movsd_back(d, s, words);
+    d -= words * 4;
+    s -= words * 4;
+
+    n -= tail + words * 4;
+  }
+
+  movsb_back(d, s, n);
+  return dest;
+}
+
+/* Copy 64 byte blocks with SSE2 from the 16 byte aligned end of the
+   target down. Each block is loaded before it is stored, so the
+   overlap does not matter. Store is movdqa or movntdq. blocks must
+   not be zero. */
+#define COPY_BLOCKS_BACK(store, d, s, blocks)                           \
+  asm volatile ("1: sub $64, %0\n"                                      \
+                "   sub $64, %1\n"                                      \
+                "   movdqu 48(%1), %%xmm3\n"                            \
+                "   movdqu 32(%1), %%xmm2\n"                            \
+                "   movdqu 16(%1), %%xmm1\n"                            \
+                "   movdqu   (%1), %%xmm0\n"                            \
+                "   " store " %%xmm3, 48(%0)\n"                         \
+                "   " store " %%xmm2, 32(%0)\n"                         \
+                "   " store " %%xmm1, 16(%0)\n"                         \
+                "   " store " %%xmm0,   (%0)\n"                         \
+                "   dec %2\n"                                           \
+                "   jnz 1b\n"                                           \
+                : "+r" (d), "+r" (s), "+r" (blocks)                     \
+                :: "memory", "xmm0", "xmm1", "xmm2", "xmm3")
+
+__attribute__((target("sse2")))
+static void *
+memmove_back_sse2_common(void *dest, const void *src, size_t n, bool stream)
+{
+  char *d = (char *)dest + n;
+  const char *s = (const char *)src + n;
+
+  if (n >= MEM_SSE2_MIN) {
+    size_t tail = (uintptr_t)d & 15;
+    size_t blocks = (n - tail) / 64;
+
+    movsb_back(d, s, tail);
+    d -= tail;
+    s -= tail;
+    n -= tail + blocks * 64;
+
+    if (stream) {
+      COPY_BLOCKS_BACK("movntdq", d, s, blocks);
+      asm volatile ("sfence" ::: "memory");
+    } else
+      COPY_BLOCKS_BACK("movdqa ", d, s, blocks);
+  }
+
+  movsb_back(d, s, n);
+  return dest;
+}
+
+void *
+memmove_back_sse2(void *dest, const void *src, size_t n)
+{
+  return memmove_back_sse2_common(dest, src, n, false);
+}
+
+/** Same with non-temporal stores. */
+void *
+memmove_back_stream(void *dest, const void *src, size_t n)
+{
+  return memmove_back_sse2_common(dest, src, n, true);
+}
+
+/* EOF */
@@ -0,0 +1,87 @@
+/* -*- Mode: C -*- */
+
+#include <util.h>
+#include <cpuid.h>
+#include <memops.h>
+
+/* Until mem_init() runs, we use what works everywhere. */
+struct mem_ops mem_ops = {
+  .copy            = memcpy_movsb,
+  .copy_large      = memcpy_movsb,
+  .move_back       = memmove_back_movsd,
+  .move_back_large = memmove_back_movsd,
+  .set             = memset_stosb,
+  .set_large       = memset_stosb,
+};
+
+const struct mem_variant mem_variants[] = {
+  { "movsb ", 0,        memcpy_movsb,  memset_stosb },
+  { "movsd ", 0,        memcpy_movsd,  memset_stosd },
+  { "sse2  ", MEM_SSE2, memcpy_sse2,   memset_sse2 },
+  { "stream", MEM_SSE2, memcpy_stream, memset_stream },
+};
+
+const unsigned mem_variant_count = sizeof(mem_variants) / sizeof(mem_variants[0]);
+
+/** Returns the enum mem_features this CPU has. */
+unsigned
+mem_features(void)
+{
+  uint32_t eax = 0, ebx, ecx, edx;
+  unsigned features = 0;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  uint32_t max_leaf = eax;
+
+  eax = 1;
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  if ((edx & CPUID_1_EDX_SSE2) && (get_cr4() & CR4_OSFXSR))
+    features |= MEM_SSE2;
+
+  if (max_leaf >= 7) {
+    eax = 7;
+    ecx = 0;
+    asm ("cpuid" : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+    if (ebx & CPUID_7_EBX_ERMS)
+      features |= MEM_ERMS;
+  }
+
+  return features;
+}
+
+/**
+ * Pick memcpy() and memset() for this CPU. Called once from
+ * start.asm before main.
+ */
+void
+mem_init(void)
+{
+  enable_sse();
+
+  unsigned features = mem_features();
+
+  if (features & MEM_ERMS) {
+    mem_ops.copy = memcpy_movsb;
+    mem_ops.set  = memset_stosb;
+  } else if (features & MEM_SSE2) {
+    mem_ops.copy = memcpy_sse2;
+    mem_ops.set  = memset_sse2;
+  } else {
+    mem_ops.copy = memcpy_movsd;
+    mem_ops.set  = memset_stosd;
+  }
+
+  if (features & MEM_SSE2) {
+    mem_ops.copy_large      = memcpy_stream;
+    mem_ops.move_back       = memmove_back_sse2;
+    mem_ops.move_back_large = memmove_back_stream;
+    mem_ops.set_large       = memset_stream;
+  } else {
+    mem_ops.copy_large      = mem_ops.copy;
+    mem_ops.move_back       = memmove_back_movsd;
+    mem_ops.move_back_large = memmove_back_movsd;
+    mem_ops.set_large       = mem_ops.set;
+  }
+}
+
+/* EOF */
@@ -1,11 +1,92 @@
 /* -*- Mode: C -*- */
 
 #include <util.h>
+#include <memops.h>
 
 void *
 memset(void *dst, int c, size_t n)
+{
+  return ((n < MEM_STREAM_MIN) ? mem_ops.set : mem_ops.set_large)(dst, c, n);
+}
+
+void *
+memset_stosb(void *dst, int c, size_t n)
+{
+  const char *d = dst;
+  asm volatile  ("rep stosb" : "+D" (d), "+c" (n) : "a" (c) : "memory");
+  return dst;
+}
+
+void *
+memset_stosd(void *dst, int c, size_t n)
+{
+  const char *d = dst;
+
+  if (n >= 16) {
+    /* Align the target. */
+    size_t head = -(uintptr_t)d & 3;
+    size_t words = (n - head) / 4;
+    uint32_t pattern = (uint8_t)c * 0x01010101U;
+
+    n -= head + words * 4;
+    asm volatile  ("rep stosb" : "+D" (d), "+c" (head) : "a" (c) : "memory");
+    asm volatile  ("rep stosl" : "+D" (d), "+c" (words) : "a" (pattern) : "memory");
+  }
+
+  asm volatile  ("rep stosb" : "+D" (d), "+c" (n) : "a" (c) : "memory");
+  return dst;
+}
+
+/* Fill 64 byte blocks of a 16 byte aligned target with a 32-bit
+   pattern. Store is movdqa or movntdq. blocks must not be zero. */
+#define SET_BLOCKS(store, d, blocks, pattern)                           \
+  asm volatile ("   movd %2, %%xmm0\n"                                  \
+                "   pshufd $0, %%xmm0, %%xmm0\n"                        \
+                "1: " store " %%xmm0,   (%0)\n"                         \
+                "   " store " %%xmm0, 16(%0)\n"                         \
+                "   " store " %%xmm0, 32(%0)\n"                         \
+                "   " store " %%xmm0, 48(%0)\n"                         \
+                "   add $64, %0\n"                                      \
+                "   dec %1\n"                                           \
+                "   jnz 1b\n"                                           \
+                : "+r" (d), "+r" (blocks) : "r" (pattern) : "memory", "xmm0")
+
+__attribute__((target("sse2")))
+static void *
+memset_sse2_common(void *dst, int c, size_t n, bool stream)
 {
   const char *d = dst;
+
+  if (n >= MEM_SSE2_MIN) {
+    size_t head = -(uintptr_t)d & 15;
+    size_t blocks = (n - head) / 64;
+    uint32_t pattern = (uint8_t)c * 0x01010101U;
+
+    n -= head + blocks * 64;
+    asm volatile  ("rep stosb" : "+D" (d), "+c" (head) : "a" (c) : "memory");
+
+    if (stream) {
+      SET_BLOCKS("movntdq", d, blocks, pattern);
+      asm volatile ("sfence" ::: "memory");
+    } else
+      SET_BLOCKS("movdqa ", d, blocks, pattern);
+  }
+
   asm volatile  ("rep stosb" : "+D" (d), "+c" (n) : "a" (c) : "memory");
   return dst;
 }
+
+void *
+memset_sse2(void *dst, int c, size_t n)
+{
+  return memset_sse2_common(dst, c, n, false);
+}
+
+/** Same with non-temporal stores, which do not pollute the cache. */
+void *
+memset_stream(void *dst, int c, size_t n)
+{
+  return memset_sse2_common(dst, c, n, true);
+}
+
+/* EOF */
@@ -11,10 +11,9 @@
 #include <version.h>
 #include <ohci.h>
 #include <cpuid.h>
+#include <irq.h>
 #include <elf.h>
 
-/* TODO: Select OHCI if there is more than one. */
-
 /* Globals */
 struct mbi *multiboot_info = 0;
 
@@ -23,9 +22,39 @@ static bool be_verbose = true;
 static bool force_enable_apic = true;
 static bool keep_going = false;
 static bool do_wait = false;
-static bool posted_writes = false;
+static enum posted_writes posted_writes = POSTED_WRITES_AUTO;
+static bool tune_pcie = true;
+static bool use_irq = true;
 static enum link_speed speed = SPEED_MAX;
 
+/* Set by ohci=bus:dev.fn or ohci=GUID */
+static enum { PIN_NONE, PIN_BDF, PIN_GUID } ohci_pin = PIN_NONE;
+static uint64_t ohci_pinned;
+
+enum {
+  MAX_OHCI = 8,
+};
+
+static void
+parse_ohci_pin(const char *arg)
+{
+  char *end;
+  uint64_t value = strtoull(arg, &end, 16);
+
+  if (*end != ':') {
+    ohci_pin = PIN_GUID;
+    ohci_pinned = value;
+    return;
+  }
+
+  unsigned bus = value;
+  unsigned dev = strtoull(end + 1, &end, 16);
+  unsigned fn  = (*end == '.') ? strtoull(end + 1, &end, 16) : 0;
+
+  ohci_pin = PIN_BDF;
+  ohci_pinned = 0x80000000 | (bus & 0xFF) << 16 | (dev & 0x1F) << 11 | (fn & 7) << 8;
+}
+
 void
 parse_cmdline(const char *cmdline)
 {
@@ -51,7 +80,13 @@ parse_cmdline(const char *cmdline)
     } else if (strcmp(token, "keepgoing") == 0) {
       keep_going = true;
     } else if (strcmp(token, "postedwrites") == 0) {
-      posted_writes = true;
+      posted_writes = POSTED_WRITES_ON;
+    } else if (strcmp(token, "nopostedwrites") == 0) {
+      posted_writes = POSTED_WRITES_OFF;
+    } else if (strcmp(token, "nopcietune") == 0) {
+      tune_pcie = false;
+    } else if (strcmp(token, "noirq") == 0) {
+      use_irq = false;
     } else if (strcmp(token, "wait") == 0) {
       do_wait = true;
     } else if (strcmp(token, "s100") == 0) { /* Where is the regexp support? ;-) */
@@ -60,6 +95,8 @@ parse_cmdline(const char *cmdline)
       speed = SPEED_S200;
     } else if (strcmp(token, "s400") == 0) {
       speed = SPEED_S400;
+    } else if (strncmp(token, "ohci=", 5) == 0) {
+      parse_ohci_pin(token + 5);
     } else {
       /* printf not possible yet. */
       //printf("Ignoring unrecognized argument: %s.\n", token);
@@ -67,6 +104,85 @@ parse_cmdline(const char *cmdline)
   }
 }
 
+static void
+error_occured(void)
+{
+  if (!keep_going) {
+    printf("An error occured. Bailing out. Use keepgoing to ignore this.\n");
+    __exit(1);
+  } else {
+    printf("An error occured. But we continue anyway.\n");
+  }
+}
+
+/** Wait for the controller to come up. */
+static void
+ohci_finish(struct ohci_controller *ohci)
+{
+  if (ohci_init_finish(ohci)) {
+    printf("Initialization complete.\n");
+  } else {
+    printf("Could not initialize controller.\n");
+    error_occured();
+  }
+}
+
+static void
+ohci_background_poll(void *arg)
+{
+  ohci_init_poll(arg);
+}
+
+static void
+ohci_background_finish(void *arg)
+{
+  ohci_finish(arg);
+  ohci_disable_interrupts(arg);
+}
+
+/**
+ * Select the controller to use. This is the pinned one, if there is
+ * a pin, or the fastest one. Among equally fast ones, we take the
+ * one with most ports and then the last one.
+ */
+static bool
+select_ohci(struct pci_device *ohci)
+{
+  struct pci_device devs[MAX_OHCI];
+  unsigned n = MIN(pci_find_devices_by_class(PCI_CLASS_SERIAL_BUS_CTRL, PCI_SUBCLASS_IEEE_1394,
+                                             devs, MAX_OHCI), (unsigned)MAX_OHCI);
+  struct ohci_link_info best_info = { 0 };
+  int best = -1;
+
+  for (unsigned i = 0; i < n; i++) {
+    struct ohci_link_info info;
+    uint32_t addr = devs[i].cfg_address;
+
+    if (!ohci_probe(&devs[i], &info))
+      continue;
+
+    printf("\n  %02x:%02x.%x S%u, %u ports, GUID 0x%llx", (addr >> 16) & 0xFF,
+           (addr >> 11) & 0x1F, (addr >> 8) & 7, 100 << info.speed, info.ports, info.guid);
+
+    if (ohci_pin != PIN_NONE) {
+      if (((ohci_pin == PIN_BDF) && (ohci_pinned == addr)) ||
+          ((ohci_pin == PIN_GUID) && (ohci_pinned == info.guid)))
+        best = i;
+    } else if ((best < 0) || (info.speed > best_info.speed) ||
+               ((info.speed == best_info.speed) && (info.ports >= best_info.ports))) {
+      best = i;
+      best_info = info;
+    }
+  }
+
+  printf("\n");
+  if (best < 0)
+    return false;
+
+  *ohci = devs[best];
+  return true;
+}
+
 int
 main(uint32_t magic, struct mbi *mbi)
 {
@@ -101,39 +217,39 @@ main(uint32_t magic, struct mbi *mbi)
     printf("Yeah, I did it. The APIC is enabled. :-)");
   }
 
-  if (posted_writes)
-    printf("Posted writes will be enabled. Disable them, if you experience problems.\n");
+  pci_init(mbi);
 
   printf("Trying to find an OHCI controller... ");
 
   struct pci_device pci_ohci;
-  struct ohci_controller ohci;
+  struct ohci_controller ohci = { .state = OHCI_INIT_FAILED };
+  bool started = false;
 
-  if (!pci_find_device_by_class(PCI_CLASS_SERIAL_BUS_CTRL, PCI_SUBCLASS_IEEE_1394, &pci_ohci)) {
-    printf("No OHCI found.\n");
+  if (!select_ohci(&pci_ohci)) {
+    printf("No %sOHCI found.\n", (ohci_pin != PIN_NONE) ? "pinned " : "");
     goto error;
   } else {
     printf("OK\n");
   }
 
-  if (!ohci_initialize(&pci_ohci, &ohci, posted_writes, speed)) {
+  /* The controller comes up on its own time. We wait for it only
+     when we need it. */
+  started = ohci_init_start(&pci_ohci, &ohci, posted_writes, tune_pcie, use_irq, speed);
+  if (!started) {
     printf("Could not initialize controller.\n");
     goto error;
-  } else {
-    printf("Initialization complete.\n");
   }
 
   goto no_error;
  error:
-  if (!keep_going) {
-    printf("An error occured. Bailing out. Use keepgoing to ignore this.\n");
-    __exit(1);
-  } else {
-    printf("An error occured. But we continue anyway.\n");
-  }
+  error_occured();
  no_error:
 
   if ((mbi->mods_count == 0) || do_wait) {
+    /* The remote needs DMA to push modules. */
+    if (started)
+      ohci_finish(&ohci);
+
     printf("Polling for events until we are kicked in the nuts.\n");
     volatile uint32_t *modules = &mbi->mods_count;
     /* Indicate that we are ready to be booted by setting
@@ -141,9 +257,19 @@ main(uint32_t magic, struct mbi *mbi)
        module... */
     *modules = 0;
     while (*modules == 0) {
-      ohci_poll_events(&ohci);
+      /* The remote's write to mods_count or its doorbell interrupt
+         wakes us up. Failing that, the timer tick does. */
+      if (ohci.irq)
+        irq_wait_write(modules, 0);
+      else
+        ohci_poll_events(&ohci);
     }
-  }
+
+    ohci_disable_interrupts(&ohci);
+  } else if (started)
+    /* Nobody needs DMA before the OS runs. Bring the controller up
+       while we load modules. */
+    background_start(ohci_background_poll, ohci_background_finish, &ohci);
 
   /* Will not return if successful. */
   return start_module(mbi, false);
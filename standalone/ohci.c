@@ -23,12 +23,25 @@
 #include <ohci-crm.h>
 #include <crc16.h>
 #include <asm.h>
+#include <irq.h>
+
+extern const char _image_start[], _image_end[];
 
 /* Constants */
 
-#define RESET_TIMEOUT 10000
-#define PHY_TIMEOUT   10000
-#define MISC_TIMEOUT  10000
+/* Timeouts in microseconds */
+#define RESET_TIMEOUT     10000000
+#define PHY_TIMEOUT       10000000
+#define MISC_TIMEOUT      10000000
+#define SCLK_TIMEOUT      100000
+#define BUS_RESET_TIMEOUT 1000000
+
+/* Polling starts at 1us and backs off to this. */
+#define POLL_MAX_STEP     100
+
+/* Events we take as interrupts. Everything else is left for
+   polling. */
+#define IRQ_EVENTS (busReset | selfIDComplete2 | postedWriteErr | unrecoverableError)
 
 /* Globals */
 
@@ -68,6 +81,14 @@ ohci_generate_crom(struct ohci_controller *ohci, enum link_speed speed)
       crom->field[2] =  (crom->field[2] & ~0xf) | speed;
     }
   }
+
+  /* Raise max_rec to what we trust the chip with, but not beyond what
+     the link speed can carry. */
+  unsigned max_rec = (crom->field[2] & BusOptions_max_rec) >> 12;
+  unsigned trusted = MIN((unsigned)ohci->pci->db->max_rec, 8 + (crom->field[2] & 0x7));
+  if (trusted > max_rec)
+    crom->field[2] = (crom->field[2] & ~BusOptions_max_rec) | trusted << 12;
+
   OHCI_INFO("BusOptions set to %x.\n", crom->field[2]);
 
   crom->field[3] = OHCI_REG(ohci, GUIDHi);
@@ -94,9 +115,12 @@ ohci_generate_crom(struct ohci_controller *ohci, enum link_speed speed)
   crom->field[16] = ' v2\0';
   crom->field[10] |= crc16(&(crom->field[11]), 6);
 
-  crom->field[17] = 0x001 << 16; /* 1 words follow */
+  crom->field[17] = 0x004 << 16; /* 4 words follow */
   crom->field[18] = (uint32_t)multiboot_info; /* Pointer to multiboot info */
-  crom->field[17] |= crc16(&(crom->field[18]), 1);
+  crom->field[19] = 0;			      /* Doorbell vector, see below */
+  crom->field[20] = (uint32_t)_image_start;   /* Where we are, so the host */
+  crom->field[21] = (uint32_t)_image_end;     /* does not place over us. */
+  crom->field[17] |= crc16(&(crom->field[18]), 4);
 
 }
 
@@ -129,8 +153,10 @@ ohci_load_crom(struct ohci_controller *ohci)
      someone reads our ConfigROM using block reads, he now gets these
      two fields byte swapped, but he violates the spec anyway.
   */
-  crom->field[0] = ntohl(crom->field[0]);
-  crom->field[2] = ntohl(crom->field[2]);
+  if (ohci->quirks & QUIRK_CROM_SWAP) {
+    crom->field[0] = ntohl(crom->field[0]);
+    crom->field[2] = ntohl(crom->field[2]);
+  }
 
   /* Reload the ConfigROM */
   OHCI_REG(ohci, ConfigROMmap) = (uint32_t)(crom->field);
@@ -140,20 +166,75 @@ ohci_load_crom(struct ohci_controller *ohci)
 
 
 
+/** Advertise the vector a remote node can send to wake us up, or 0
+    if it should not send any. The ConfigROM is already loaded, but
+    the controller serves reads beyond the bus info block from
+    memory, so we patch it in place. */
+static void
+ohci_crom_doorbell(struct ohci_controller *ohci, uint8_t vector)
+{
+  ohci_config_rom_t *crom = ohci->crom;
+  uint32_t leaf[4] = { (uint32_t)multiboot_info, vector,
+                       (uint32_t)_image_start, (uint32_t)_image_end };
+
+  crom->field[19] = ntohl(leaf[1]);
+  crom->field[17] = ntohl(0x004 << 16 | crc16(leaf, 4));
+}
+
+/** Poll until a register has the expected value. Polling backs off
+    exponentially, so short waits end early and long ones don't keep
+    the bus busy. */
 static void
-wait_loop(struct ohci_controller *ohci, uint32_t reg, uint32_t mask, uint32_t value, uint32_t max_ticks)
+wait_loop(struct ohci_controller *ohci, uint32_t reg, uint32_t mask, uint32_t value, uint32_t timeout_us)
 {
-  unsigned i = 0;
+  struct deadline timeout = deadline_in_us(timeout_us);
+  unsigned step = 1;
 
   while ((OHCI_REG(ohci, reg) & mask) != value) {
-    wait(1);
-    if (i++ > max_ticks) {
+    if (deadline_passed(timeout)) {
       printf("waiting for reg %x mask %x value %x\n", reg, mask, value);
       __exit(0xdeeed);
     }
+    udelay(step);
+    step = MIN(2*step, POLL_MAX_STEP);
   }
 }
 
+/** Read a PHY register right after LPS was set. Until SCLK runs, the
+    controller fails PHY accesses with regAccessFail, so we retry with
+    backoff. Returns false, if the PHY did not answer in time. */
+static bool
+phy_read_early(struct ohci_controller *ohci, uint8_t addr, uint8_t *data)
+{
+  struct deadline timeout = deadline_in_us(SCLK_TIMEOUT);
+  unsigned step = 1;
+  bool issue = true;
+
+  while (!deadline_passed(timeout)) {
+    if (issue) {
+      OHCI_REG(ohci, IntEventClear) = regAccessFail;
+      OHCI_REG(ohci, PhyControl) = PhyControl_Read(addr);
+      issue = false;
+    }
+
+    udelay(step);
+
+    uint32_t phycontrol = OHCI_REG(ohci, PhyControl);
+    if (phycontrol & PhyControl_ReadDone) {
+      *data = PhyControl_ReadData(phycontrol);
+      return true;
+    }
+
+    /* No SCLK yet. Try again a bit later. */
+    if (OHCI_REG(ohci, IntEventSet) & regAccessFail) {
+      issue = true;
+      step = MIN(2*step, POLL_MAX_STEP);
+    }
+  }
+
+  return false;
+}
+
 static uint8_t
 phy_read(struct ohci_controller *ohci, uint8_t addr)
 {
@@ -200,17 +281,6 @@ ohci_force_bus_reset(struct ohci_controller *ohci)
   phy_write(ohci, 1, phy1);
 }
 
-/** Perform a soft-reset of the Open Host Controller and wait until it
- *  has reinitialized itself.
- */
-static void
-ohci_softreset(struct ohci_controller *ohci)
-{
-  OHCI_INFO("Soft-resetting controller...\n");
-  OHCI_REG(ohci, HCControlSet) = HCControl_softReset;
-  wait_loop(ohci, HCControlSet, HCControl_softReset, 0, RESET_TIMEOUT);
-}
-
 /* Check version of controller. Returns true, if it is supported. */
 static bool
 ohci_check_version(struct ohci_controller *ohci)
@@ -232,119 +302,157 @@ ohci_check_version(struct ohci_controller *ohci)
   return true;
 }
 
+/** Find out how fast a controller is and how many ports it has,
+ * without initializing it. The PHY only answers with LPS set, so we
+ * turn it on for a moment, if it is not on already.
+ * \param pci_dev the controller.
+ * \param info filled out on success.
+ */
 bool
-ohci_initialize(const struct pci_device *pci_dev,
-		struct ohci_controller *ohci,
-		bool posted_writes,
-		enum link_speed speed)
+ohci_probe(const struct pci_device *pci_dev, struct ohci_link_info *info)
 {
-  ohci->pci = pci_dev;
-  ohci->ohci_regs = (volatile uint32_t *) pci_cfg_read_uint32(ohci->pci, PCI_CFG_BAR0);
-  ohci->posted_writes = posted_writes;
+  struct ohci_controller probe = { .pci = pci_dev };
+  struct ohci_controller *ohci = &probe;
 
-  assert((uint32_t)ohci->ohci_regs != 0xFFFFFFFF, "Invalid PCI read?");
+  ohci->ohci_regs = (volatile uint32_t *) pci_cfg_read_uint32(pci_dev, PCI_CFG_BAR0);
+  if ((ohci->ohci_regs == NULL) || ((uint32_t)ohci->ohci_regs == 0xFFFFFFFF) ||
+      (OHCI_REG(ohci, Version) == 0xFFFFFFFF))
+    return false;
 
-  uint32_t vendor = pci_read_uint32(pci_dev->cfg_address + PCI_CFG_VENDOR_ID);
-  OHCI_INFO("Controller (%x:%x) = %s.\n",
-	    vendor & 0xffff,
-	    (vendor >> 16) & 0xffff,
-	    pci_dev->db->device_name);
+  info->speed = OHCI_REG(ohci, BusOptions) & 0x7;
+  info->guid  = (uint64_t)(OHCI_REG(ohci, GUIDHi)) << 32 | OHCI_REG(ohci, GUIDLo);
+  info->ports = 0;
 
-  if (ohci->ohci_regs == NULL) {
-    printf("Uh? OHCI register pointer is NULL.\n");
-    return false;
-  }
+  bool lps = OHCI_REG(ohci, HCControlSet) & HCControl_LPS;
 
-  if (!ohci_check_version(ohci)) {
-    return false;
+  if (!lps)
+    OHCI_REG(ohci, HCControlSet) = HCControl_LPS;
+
+  uint8_t phy_2;
+  if (phy_read_early(ohci, 2, &phy_2))
+    info->ports = phy_2 & ((1<<5) - 1);
+
+  if (!lps)
+    OHCI_REG(ohci, HCControlClear) = HCControl_LPS;
+
+  return true;
+}
+
+static void
+ohci_irq(void *arg)
+{
+  struct ohci_controller *ohci = arg;
+  uint32_t events;
+
+  /* IntEventClear reads the events that are not masked. Handle them
+     until the controller has nothing left to say, so a level
+     triggered line goes quiet. */
+  while ((events = OHCI_REG(ohci, IntEventClear) & IRQ_EVENTS) != 0) {
+    ohci->interrupts++;
+
+    /* While a bus reset is pending, its busReset is masked and the
+       self-IDs coming in signal that it can be handled now. */
+    if (((events & ~selfIDComplete2) != 0) ||
+	((OHCI_REG(ohci, IntEventSet) & busReset) != 0))
+      ohci_poll_events(ohci);
+    else
+      /* Bus reset handling clears this. If it shows up alone, nobody
+	 else will. */
+      OHCI_REG(ohci, IntEventClear) = selfIDComplete2;
   }
+}
 
-  /* Do a softreset. */
-  ohci_softreset(ohci);
+/** The bus reset we forced is over, once its self-IDs are in, we
+    have handled it and we have a node ID. */
+static bool
+ohci_bus_settled(struct ohci_controller *ohci, uint8_t generation)
+{
+  return (((OHCI_REG(ohci, SelfIDCount) >> 16) & 0xFF) != generation) &&
+    ((OHCI_REG(ohci, IntEventSet) & (busReset | selfIDComplete2)) == 0) &&
+    ((OHCI_REG(ohci, NodeID) & NodeID_idValid) != 0);
+}
 
-  /* Disable linkEnable to be able to configure the low level stuff. */
-  OHCI_REG(ohci, HCControlClear) = HCControl_linkEnable;
-  wait_loop(ohci, HCControlSet, HCControl_linkEnable, 0, MISC_TIMEOUT);
+/** Route controller events to ohci_irq. Returns false, if
+    interrupts cannot be used and we have to poll. */
+static bool
+ohci_enable_interrupts(struct ohci_controller *ohci)
+{
+  ohci->interrupts = 0;
 
-  /* Disable stuff we don't want/need, including byte swapping. */
-  OHCI_REG(ohci, HCControlClear) = HCControl_noByteSwapData | HCControl_ackTardyEnable;
+  if (!irq_init())
+    return false;
 
-  /* Enable (or disable) posted writes. With posted writes enabled, the controller
-     may return ack_complete for physical write requests, even if the
-     data has not been written yet. For coherency considerations,
-     refer to Chapter 3.3.3 in the OHCI spec. */
-  OHCI_REG(ohci, posted_writes ? HCControlSet : HCControlClear) = HCControl_postedWriteEnable;
+  if (!irq_route_pci(ohci->pci, ohci_irq, ohci)) {
+    irq_shutdown();
+    return false;
+  }
 
-  /* XXX BEGIN CRAP CODE Enable LPS. This is more complicated than it
-     should be, but hardware sucks... */
-  unsigned lps_retries;
-  for (lps_retries = 10; lps_retries > 0; lps_retries--) {
-    unsigned wait_more_cnt = 10;
-    uint32_t phycontrol, intevent;
+  OHCI_REG(ohci, IntMaskClear) = ~0U;
+  OHCI_REG(ohci, IntMaskSet) = IRQ_EVENTS | masterIntEnable;
+  return true;
+}
 
-    OHCI_REG(ohci, HCControlSet) = HCControl_LPS;
-    wait_loop(ohci, HCControlSet, HCControl_LPS, HCControl_LPS, MISC_TIMEOUT);
-
-    wait(50);			/* SCLK should be up by now */
-
-    OHCI_REG(ohci, IntEventClear) = ~0U;
-    OHCI_REG(ohci, PhyControl) = PhyControl_Read(1);
-
-  wait_some_more:
-    wait(50);
-
-    phycontrol = OHCI_REG(ohci, PhyControl);
-    intevent   = OHCI_REG(ohci, IntEventSet);
-    if (((phycontrol & PhyControl_ReadDone) == 0) &&
-	((intevent   & regAccessFail) == 0)) {
-      /* Nothing happened yet. This can mean two things: a) the read
-	 is not completed, which is unlikely given that we waited 10ms
-	 for it. b) SCLK did not start and the PHY is not
-	 available. In the latter case regAccessFail should be set,
-	 but this does not seem to work. */
-      OHCI_INFO("SCLK seems not to be running.\n");
-      /* Start over. */
-      goto next;
-    }
+void
+ohci_disable_interrupts(struct ohci_controller *ohci)
+{
+  if (!ohci->irq)
+    return;
 
-    if ((intevent & regAccessFail) != 0) {
-      /* SCLK has not started yet. Wait some more. */
-      OHCI_INFO("regAccessFail while waiting for SCLK to start.\n");
-      if (wait_more_cnt-- > 0)
-	goto wait_some_more;
-      else {
-	OHCI_INFO("LPS did not come up.\n");
-	return false;
-      }
-    }
+  ohci_crom_doorbell(ohci, 0);
+  OHCI_REG(ohci, IntMaskClear) = ~0U;
+  irq_shutdown();
+  ohci->irq = false;
+}
 
-    /* Read done. */
-    break;
+/** Enter a new bring-up state, which has timeout_us to complete. */
+static void
+ohci_set_state(struct ohci_controller *ohci, enum ohci_init_state state, uint32_t timeout_us)
+{
+  ohci->state = state;
+  ohci->timeout = deadline_in_us(timeout_us);
+  ohci->next_poll = deadline_in_us(0);
+  ohci->step = 1;
+}
 
-  next:
-    OHCI_INFO("%d retries left.\n", lps_retries);
+/** Don't look at the hardware again for a while. Waits back off
+    exponentially, like wait_loop(). */
+static void
+ohci_poll_later(struct ohci_controller *ohci)
+{
+  ohci->next_poll = deadline_in_us(ohci->step);
+  ohci->step = MIN(2*ohci->step, POLL_MAX_STEP);
+}
 
-    /* Disable LPS */
-    OHCI_REG(ohci, HCControlClear) = HCControl_LPS;
-    OHCI_INFO("Waiting for LPS clear.\n");
-    wait_loop(ohci, HCControlSet, HCControl_LPS, 0, MISC_TIMEOUT);
-    OHCI_INFO("Done.\n");
-  }
+static enum ohci_init_state
+ohci_init_fail(struct ohci_controller *ohci, const char *msg)
+{
+  OHCI_INFO("%s\n", msg);
+  ohci->state = OHCI_INIT_FAILED;
+  return ohci->state;
+}
 
-  if (lps_retries == 0) {
-    OHCI_INFO("LPS did not come up.\n");
-    return false;
-  }
+static void
+ohci_start_lps(struct ohci_controller *ohci)
+{
+  OHCI_REG(ohci, HCControlSet) = HCControl_LPS;
+  wait_loop(ohci, HCControlSet, HCControl_LPS, HCControl_LPS, MISC_TIMEOUT);
 
-  /* XXX END CRAP CODE */
+  OHCI_REG(ohci, IntEventClear) = ~0U;
+  ohci->phy_read_pending = false;
+  ohci_set_state(ohci, OHCI_INIT_LPS, SCLK_TIMEOUT);
+}
 
+/** LPS is up. We can now talk to the PHY and set up the link. None
+    of this waits for long. */
+static void
+ohci_configure(struct ohci_controller *ohci)
+{
   /* Disable contender bit */
   uint8_t phy4 = phy_read(ohci, 4);
   phy_write(ohci, 4, phy4 & ~0x40);
 
-  /* LPS is up. We can now communicate with the PHY. Discover how many
-     ports we have and whether this PHY supports the enhanced register
-     map. */
+  /* Discover how many ports we have and whether this PHY supports
+     the enhanced register map. */
   uint8_t phy_2 = phy_read(ohci, 2);
   ohci->total_ports = phy_2 & ((1<<5) - 1);
   ohci->enhanced_phy_map = (phy_2 >> 5) == 7;
@@ -370,7 +478,9 @@ ohci_initialize(const struct pci_device *pci_dev,
 
   /* Check if we are responsible for configuring IEEE1394a
      enhancements. */
-  if (OHCI_REG(ohci, HCControlSet) & HCControl_programPhyEnable) {
+  if (ohci->quirks & QUIRK_NO_1394A) {
+    OHCI_INFO("IEEE1394a enhancements are broken on this controller. Leaving them alone.\n");
+  } else if (OHCI_REG(ohci, HCControlSet) & HCControl_programPhyEnable) {
     OHCI_INFO("Enabling IEEE1394a enhancements.\n");
     OHCI_REG(ohci, HCControlSet) = HCControl_aPhyEnhanceEnable;
     /* XXX We should probably do more here. Check:
@@ -398,9 +508,6 @@ ohci_initialize(const struct pci_device *pci_dev,
   /* } */
 
   /* Set SelfID buffer */
-  ohci->selfid_buf = mbi_alloc_protected_memory(multiboot_info, sizeof(uint32_t[504]), 11);
-  OHCI_INFO("Allocated SelfID buffer at %p.\n", ohci->selfid_buf);
-
   ohci->selfid_buf[0] = 0xDEADBEEF; /* error checking */
   OHCI_REG(ohci, SelfIDBuffer) = (uint32_t)ohci->selfid_buf;
   OHCI_REG(ohci, LinkControlSet) = LinkControl_rcvSelfID;
@@ -413,41 +520,281 @@ ohci_initialize(const struct pci_device *pci_dev,
   }
 
   /* Set Config ROM */
-  ohci->crom = mbi_alloc_protected_memory(multiboot_info, sizeof(ohci_config_rom_t), 10);
-  OHCI_INFO("ConfigROM allocated at %p.\n", ohci->crom);
-
-  ohci_generate_crom(ohci, speed);
+  ohci_generate_crom(ohci, ohci->speed);
   ohci_load_crom(ohci);
 
   /* enable link */
   OHCI_REG(ohci, HCControlSet) = HCControl_linkEnable;
+  ohci_set_state(ohci, OHCI_INIT_LINK_ENABLE, MISC_TIMEOUT);
+}
 
-  /* Wait for link to come up. */
-  wait_loop(ohci, HCControlSet, HCControl_linkEnable, HCControl_linkEnable, MISC_TIMEOUT);
+/** The link is up. Force a bus reset and take its events as
+    interrupts, if we can. */
+static void
+ohci_start_bus_reset(struct ohci_controller *ohci)
+{
   OHCI_INFO("Link is up. Force bus reset.\n");
 
-  /* Force bus reset and wait for it to complete and then some more
-     for the link to calm down. */
-  uint8_t generation = (OHCI_REG(ohci, SelfIDCount) >> 16) & 0xFF;
-  unsigned poll_count = 0;
+  ohci->generation = (OHCI_REG(ohci, SelfIDCount) >> 16) & 0xFF;
+
+  if (ohci->use_irq) {
+    ohci->irq = ohci_enable_interrupts(ohci);
+    if (!ohci->irq)
+      OHCI_INFO("No interrupts. Polling for events.\n");
+  }
+
   ohci_force_bus_reset(ohci);
+  ohci_set_state(ohci, OHCI_INIT_BUS_RESET, BUS_RESET_TIMEOUT);
+}
 
-  while (poll_count++ < 1000) {
+/** Service bus reset events while we wait for the reset to finish. */
+static void
+ohci_serve_events(struct ohci_controller *ohci)
+{
+  if (ohci->irq)
+    irq_poll();
+  else
     ohci_poll_events(ohci);
-    wait(1);
+}
+
+/** The bus reset did not finish in time. */
+static void
+ohci_bus_reset_timeout(struct ohci_controller *ohci)
+{
+  /* We forced a bus reset, so there should have been an
+     interrupt. If not, the routing is wrong and we poll. Polling
+     gets another full timeout. */
+  if (ohci->irq && (ohci->interrupts == 0)) {
+    OHCI_INFO("Bus reset did not interrupt. Polling for events.\n");
+    ohci_disable_interrupts(ohci);
+    ohci_set_state(ohci, ohci->state, BUS_RESET_TIMEOUT);
+    return;
   }
 
-  if (generation == ((OHCI_REG(ohci, SelfIDCount) >> 16) & 0xFF))
-    OHCI_INFO("No bus reset (or a lot of them)? Things may be b0rken.\n");
+  OHCI_INFO("No bus reset (or a lot of them)? Things may be b0rken.\n");
+  ohci->state = OHCI_INIT_DONE;
+}
+
+static void
+ohci_init_done(struct ohci_controller *ohci)
+{
+  if (ohci->irq)
+    ohci_crom_doorbell(ohci, IRQ_DOORBELL_VECTOR);
+
+  OHCI_INFO("Bring-up took %u us.\n", (uint32_t)((now_ns() - ohci->bringup_start) / 1000));
 
   /* Print GUID for easy reference. */
   OHCI_INFO("GUID: 0x%llx\n", (uint64_t)(OHCI_REG(ohci, GUIDHi)) << 32 | OHCI_REG(ohci, GUIDLo));
+}
+
+bool
+ohci_init_start(const struct pci_device *pci_dev,
+		struct ohci_controller *ohci,
+		enum posted_writes posted_writes,
+		bool tune_pcie,
+		bool use_irq,
+		enum link_speed speed)
+{
+  ohci->bringup_start = now_ns();
+  ohci->state = OHCI_INIT_FAILED;
+  ohci->pci = pci_dev;
+  ohci->irq = false;
+  ohci->use_irq = use_irq;
+  ohci->speed = speed;
+  ohci->ohci_regs = (volatile uint32_t *) pci_cfg_read_uint32(ohci->pci, PCI_CFG_BAR0);
+  ohci->quirks = pci_dev->db->quirks;
+  ohci->posted_writes = (posted_writes == POSTED_WRITES_ON) ||
+    ((posted_writes == POSTED_WRITES_AUTO) && (ohci->quirks & QUIRK_POSTED_WRITES_OK));
+
+  assert((uint32_t)ohci->ohci_regs != 0xFFFFFFFF, "Invalid PCI read?");
+
+  uint32_t vendor = pci_read_uint32(pci_dev->cfg_address + PCI_CFG_VENDOR_ID);
+  OHCI_INFO("Controller (%x:%x) = %s.\n",
+	    vendor & 0xffff,
+	    (vendor >> 16) & 0xffff,
+	    pci_dev->db->device_name);
+
+  if (ohci->ohci_regs == NULL) {
+    printf("Uh? OHCI register pointer is NULL.\n");
+    return false;
+  }
+
+  if (!ohci_check_version(ohci)) {
+    return false;
+  }
+
+  /* Physical DMA is only as fast as the path to memory allows. */
+  if (tune_pcie)
+    pci_tune_path(pci_dev->cfg_address);
+
+  /* Allocate memory now. Later, the rest of the boot loader may be
+     busy moving modules around. */
+  ohci->selfid_buf = mbi_alloc_protected_memory(multiboot_info, sizeof(uint32_t[504]), 11);
+  OHCI_INFO("Allocated SelfID buffer at %p.\n", ohci->selfid_buf);
+
+  ohci->crom = mbi_alloc_protected_memory(multiboot_info, sizeof(ohci_config_rom_t), 10);
+  OHCI_INFO("ConfigROM allocated at %p.\n", ohci->crom);
+
+  OHCI_INFO("Soft-resetting controller...\n");
+  OHCI_REG(ohci, HCControlSet) = HCControl_softReset;
+  ohci_set_state(ohci, OHCI_INIT_SOFTRESET, RESET_TIMEOUT);
 
   return true;
 }
 
-/** Handle a bus reset condition. Does not return until the reset is
-    handled. */
+enum ohci_init_state
+ohci_init_poll(struct ohci_controller *ohci)
+{
+  if ((ohci->state == OHCI_INIT_DONE) || (ohci->state == OHCI_INIT_FAILED) ||
+      !deadline_passed(ohci->next_poll))
+    return ohci->state;
+
+  switch (ohci->state) {
+  case OHCI_INIT_SOFTRESET:
+    if (OHCI_REG(ohci, HCControlSet) & HCControl_softReset) {
+      if (deadline_passed(ohci->timeout))
+	return ohci_init_fail(ohci, "Soft reset did not complete.");
+      ohci_poll_later(ohci);
+      break;
+    }
+
+    /* Disable linkEnable to be able to configure the low level stuff. */
+    OHCI_REG(ohci, HCControlClear) = HCControl_linkEnable;
+    wait_loop(ohci, HCControlSet, HCControl_linkEnable, 0, MISC_TIMEOUT);
+
+    /* Disable stuff we don't want/need, including byte swapping. */
+    OHCI_REG(ohci, HCControlClear) = HCControl_noByteSwapData | HCControl_ackTardyEnable;
+
+    /* Enable (or disable) posted writes. With posted writes enabled, the controller
+       may return ack_complete for physical write requests, even if the
+       data has not been written yet. For coherency considerations,
+       refer to Chapter 3.3.3 in the OHCI spec. */
+    OHCI_REG(ohci, ohci->posted_writes ? HCControlSet : HCControlClear) = HCControl_postedWriteEnable;
+    if (ohci->posted_writes)
+      OHCI_INFO("Posted writes enabled. Disable them with nopostedwrites, if you experience problems.\n");
+
+    ohci->lps_retries = 10;
+    ohci_start_lps(ohci);
+    break;
+
+  case OHCI_INIT_LPS: {
+    /* The PHY answers once SCLK runs, which takes anything from
+       microseconds to tens of milliseconds. Until then, the
+       controller fails PHY accesses with regAccessFail. */
+    if (!ohci->phy_read_pending) {
+      OHCI_REG(ohci, IntEventClear) = regAccessFail;
+      OHCI_REG(ohci, PhyControl) = PhyControl_Read(1);
+      ohci->phy_read_pending = true;
+      ohci_poll_later(ohci);
+      break;
+    }
+
+    if (OHCI_REG(ohci, PhyControl) & PhyControl_ReadDone) {
+      ohci_set_state(ohci, OHCI_INIT_PHY_CONFIG, 0);
+      break;
+    }
+
+    if (OHCI_REG(ohci, IntEventSet) & regAccessFail)
+      ohci->phy_read_pending = false;
+
+    if (!deadline_passed(ohci->timeout)) {
+      ohci_poll_later(ohci);
+      break;
+    }
+
+    /* SCLK never came. Toggle LPS and try again. */
+    if (--ohci->lps_retries == 0)
+      return ohci_init_fail(ohci, "LPS did not come up.");
+
+    OHCI_INFO("SCLK seems not to be running. %d retries left.\n", ohci->lps_retries);
+    OHCI_REG(ohci, HCControlClear) = HCControl_LPS;
+    wait_loop(ohci, HCControlSet, HCControl_LPS, 0, MISC_TIMEOUT);
+    ohci_start_lps(ohci);
+    break;
+  }
+
+  case OHCI_INIT_PHY_CONFIG:
+    ohci_configure(ohci);
+    break;
+
+  case OHCI_INIT_LINK_ENABLE:
+    if (OHCI_REG(ohci, HCControlSet) & HCControl_linkEnable) {
+      ohci_start_bus_reset(ohci);
+      break;
+    }
+    if (deadline_passed(ohci->timeout))
+      return ohci_init_fail(ohci, "Link did not come up.");
+    ohci_poll_later(ohci);
+    break;
+
+  case OHCI_INIT_BUS_RESET:
+    /* The self-ID phase is over, once the generation changes. */
+    ohci_serve_events(ohci);
+    if (((OHCI_REG(ohci, SelfIDCount) >> 16) & 0xFF) != ohci->generation)
+      ohci->state = OHCI_INIT_SELF_ID;
+    else if (deadline_passed(ohci->timeout))
+      ohci_bus_reset_timeout(ohci);
+    else
+      ohci_poll_later(ohci);
+    break;
+
+  case OHCI_INIT_SELF_ID:
+    /* Wait until we have handled the self-IDs and have a node ID. */
+    ohci_serve_events(ohci);
+    if (ohci_bus_settled(ohci, ohci->generation))
+      ohci->state = OHCI_INIT_DONE;
+    else if (deadline_passed(ohci->timeout))
+      ohci_bus_reset_timeout(ohci);
+    else
+      ohci_poll_later(ohci);
+    break;
+
+  default:
+    break;
+  }
+
+  if (ohci->state == OHCI_INIT_DONE)
+    ohci_init_done(ohci);
+
+  return ohci->state;
+}
+
+bool
+ohci_init_finish(struct ohci_controller *ohci)
+{
+  for (;;) {
+    enum ohci_init_state state = ohci_init_poll(ohci);
+
+    if (state == OHCI_INIT_DONE)
+      return true;
+    if (state == OHCI_INIT_FAILED)
+      return false;
+
+    /* Only the controller can end the bus reset. Sleep until it
+       tells us. */
+    if (ohci->irq && (state >= OHCI_INIT_BUS_RESET))
+      irq_wait();
+    else
+      asm volatile ("pause");
+  }
+}
+
+bool
+ohci_initialize(const struct pci_device *pci_dev,
+		struct ohci_controller *ohci,
+		enum posted_writes posted_writes,
+		bool tune_pcie,
+		bool use_irq,
+		enum link_speed speed)
+{
+  return ohci_init_start(pci_dev, ohci, posted_writes, tune_pcie, use_irq, speed) &&
+    ohci_init_finish(ohci);
+}
+
+/** Handle a bus reset condition. The self-ID phase follows and we
+    do not wait for it: Until it is complete, the reset stays pending
+    with busReset masked, and we come back for it once
+    selfIDComplete2 is set. */
 void
 ohci_handle_bus_reset(struct ohci_controller *ohci)
 {
@@ -455,17 +802,25 @@ ohci_handle_bus_reset(struct ohci_controller *ohci)
   OHCI_REG(ohci, AsReqTrContextControlClear) = 1 << 15;
   OHCI_REG(ohci, AsRspTrContextControlClear) = 1 << 15;
 
-  /* Wait for active DMA to finish. (We don't do DMA... ) */
-  wait_loop(ohci, AsReqTrContextControlSet, ATactive, 0, 10);
-  wait_loop(ohci, AsRspTrContextControlSet, ATactive, 0, 10);
-
-  /* Wait for completion of SelfID phase. */
+  /* Check for completion of SelfID phase. */
   assert(OHCI_REG(ohci, LinkControlSet) & LinkControl_rcvSelfID,
 	 "selfID receive borken");
-  wait_loop(ohci, IntEventSet, selfIDComplete2, selfIDComplete2, 1000);
+  if ((OHCI_REG(ohci, IntEventSet) & selfIDComplete2) == 0) {
+    OHCI_REG(ohci, IntMaskClear) = busReset;
+    return;
+  }
+
+  OHCI_INFO("Bus reset!\n");
+
+  /* Wait for active DMA to finish. (We don't do DMA... ) */
+  wait_loop(ohci, AsReqTrContextControlSet, ATactive, 0, 10000);
+  wait_loop(ohci, AsRspTrContextControlSet, ATactive, 0, 10000);
 
-  /* We are done. Clear bus reset indication bits. */
+  /* We are done. Clear bus reset indication bits and let the next
+     bus reset interrupt again. */
   OHCI_REG(ohci, IntEventClear) = busReset | selfIDComplete2;
+  if (ohci->irq)
+    OHCI_REG(ohci, IntMaskSet) = busReset;
 
   /* Reset request filters. They are cleared on bus reset. */
   OHCI_REG(ohci, AsReqFilterHiSet) = ~0U;
@@ -500,7 +855,6 @@ ohci_poll_events(struct ohci_controller *ohci)
   uint32_t intevent = OHCI_REG(ohci, IntEventSet); /* Unmasked event bitfield */
 
   if ((intevent & busReset) != 0) {
-    OHCI_INFO("Bus reset!\n");
     ohci_handle_bus_reset(ohci);
   } else if ((intevent & postedWriteErr) != 0) {
     OHCI_INFO("Posted Write Error\n");
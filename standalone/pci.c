@@ -16,25 +16,172 @@
 
 #include <util.h>
 #include <pci.h>
+#include <acpi.h>
+#include <mbi-tools.h>
+
+/* ECAM window of segment 0, if the MCFG table has one. */
+static volatile uint8_t *pci_ecam;
+static unsigned pci_ecam_start_bus, pci_ecam_end_bus;
+
+/** Offset of a config space address in the ECAM window. */
+static inline uint32_t
+pci_ecam_offset(unsigned addr)
+{
+  return ((addr & 0x00FFFF00) << 4) | (addr & 0xFF) | (((addr >> 24) & 0xF) << 8);
+}
+
+static inline bool
+pci_ecam_covers(unsigned addr)
+{
+  unsigned bus = (addr >> 16) & 0xFF;
+  return pci_ecam && (bus >= pci_ecam_start_bus) && (bus <= pci_ecam_end_bus);
+}
 
 /**
- * Read a byte from the pci config space.
+ * Use memory-mapped config space, if the MCFG table describes it for
+ * segment 0 below 4GB. Otherwise config space is accessed through
+ * ports and the extended registers stay out of reach.
+ */
+bool
+pci_ecam_init(void)
+{
+  struct rsdp *rsdp = acpi_get_rsdp();
+  if (!rsdp)
+    return false;
+
+  struct acpi_table **ptab = acpi_get_table_ptr((struct acpi_table *)rsdp->rsdt, "MCFG");
+  if (!ptab || !*ptab)
+    return false;
+
+  struct mcfg *mcfg = (struct mcfg *)*ptab;
+  unsigned count = (mcfg->generic.size - sizeof(*mcfg)) / sizeof(mcfg->entry[0]);
+
+  for (unsigned i = 0; i < count; i++) {
+    struct mcfg_entry *e = &mcfg->entry[i];
+
+    if ((e->segment != 0) || (e->base >> 32))
+      continue;
+
+    /* The window starts at bus 0, even if the first bus is not. */
+    pci_ecam = (volatile uint8_t *)(uintptr_t)e->base;
+    pci_ecam_start_bus = e->start_bus;
+    pci_ecam_end_bus   = e->end_bus;
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Read a byte from the pci config space via ports.
  */
 uint8_t
-pci_read_uint8(unsigned addr)
+pci_port_read_uint8(unsigned addr)
 {
+  if (addr & PCI_CFG_EXT_MASK)
+    return ~0;
+
   outl(PCI_ADDR_PORT, addr);
   return inb(PCI_DATA_PORT + (addr & 3));
 }
 
+/**
+ * Read a long from the pci config space via ports.
+ */
+uint32_t
+pci_port_read_uint32(unsigned addr)
+{
+  if (addr & PCI_CFG_EXT_MASK)
+    return ~0U;
+
+  outl(PCI_ADDR_PORT, addr);
+  return inl(PCI_DATA_PORT);
+}
+
+/**
+ * Read a long from the memory-mapped pci config space. The caller
+ * checks that it is there.
+ */
+uint32_t
+pci_ecam_read_uint32(unsigned addr)
+{
+  return *(volatile uint32_t *)(pci_ecam + pci_ecam_offset(addr));
+}
+
+/**
+ * Read a byte from the pci config space.
+ */
+uint8_t
+pci_read_uint8(unsigned addr)
+{
+  if (pci_ecam_covers(addr))
+    return pci_ecam[pci_ecam_offset(addr)];
+
+  return pci_port_read_uint8(addr);
+}
+
 /**
  * Read a long from the pci config space.
  */
 uint32_t
 pci_read_uint32(unsigned addr)
 {
+  if (pci_ecam_covers(addr))
+    return pci_ecam_read_uint32(addr);
+
+  return pci_port_read_uint32(addr);
+}
+
+/**
+ * Read a word from the pci config space.
+ */
+uint16_t
+pci_read_uint16(unsigned addr)
+{
+  if (pci_ecam_covers(addr))
+    return *(volatile uint16_t *)(pci_ecam + pci_ecam_offset(addr));
+
+  if (addr & PCI_CFG_EXT_MASK)
+    return ~0;
+
   outl(PCI_ADDR_PORT, addr);
-  return inl(PCI_DATA_PORT);
+  return inw(PCI_DATA_PORT + (addr & 2));
+}
+
+/**
+ * Write a byte to the pci config space.
+ */
+void
+pci_write_uint8(unsigned addr, uint8_t value)
+{
+  if (pci_ecam_covers(addr)) {
+    pci_ecam[pci_ecam_offset(addr)] = value;
+    return;
+  }
+
+  if (addr & PCI_CFG_EXT_MASK)
+    return;
+
+  outl(PCI_ADDR_PORT, addr);
+  outb(PCI_DATA_PORT + (addr & 3), value);
+}
+
+/**
+ * Write a word to the pci config space.
+ */
+void
+pci_write_uint16(unsigned addr, uint16_t value)
+{
+  if (pci_ecam_covers(addr)) {
+    *(volatile uint16_t *)(pci_ecam + pci_ecam_offset(addr)) = value;
+    return;
+  }
+
+  if (addr & PCI_CFG_EXT_MASK)
+    return;
+
+  outl(PCI_ADDR_PORT, addr);
+  outw(PCI_DATA_PORT + (addr & 2), value);
 }
 
 /**
@@ -43,49 +190,256 @@ pci_read_uint32(unsigned addr)
 void
 pci_write_uint32(unsigned addr, uint32_t value)
 {
+  if (pci_ecam_covers(addr)) {
+    *(volatile uint32_t *)(pci_ecam + pci_ecam_offset(addr)) = value;
+    return;
+  }
+
+  if (addr & PCI_CFG_EXT_MASK)
+    return;
+
   outl(PCI_ADDR_PORT, addr);
   outl(PCI_DATA_PORT, value);
 }
 
 
 /* Fillout pci_device structure. */
+static void
+populate_device_info(const struct pci_entry *e, struct pci_device *dev)
+{
+  dev->db = pci_lookup_device(e->vendor_id, e->device_id);
+  dev->cfg_address = e->cfg_address;
+}
+
+static struct {
+  struct pci_table table;
+  struct pci_entry dev[PCI_MAX_DEVICES];
+} pci_scan_buf;
+
+static const struct pci_table *pci_table;
+static uint32_t pci_scanned_buses[256 / 32];
+static unsigned pci_dropped;
+
+/**
+ * Add all functions on a bus to the table and descend into the buses
+ * behind bridges. Every bus is visited once, even if bridges are
+ * misconfigured.
+ */
+static void
+pci_scan_bus(struct pci_table *t, unsigned bus)
+{
+  if (pci_scanned_buses[bus / 32] & (1U << (bus % 32)))
+    return;
+  pci_scanned_buses[bus / 32] |= 1U << (bus % 32);
+
+  for (unsigned device = 0; device < 32; device++) {
+    uint8_t maxfunc = 0;
+
+    for (unsigned func = 0; func <= maxfunc; func++) {
+      uint32_t addr = 0x80000000 | bus << 16 | device << 11 | func << 8;
+      uint32_t id = pci_read_uint32(addr + PCI_CFG_VENDOR_ID);
+
+      if ((id & 0xFFFF) == 0xFFFF)
+        continue;
+
+      uint8_t type = pci_read_uint8(addr + PCI_CFG_HEADER_TYPE);
+      if ((func == 0) && (type & PCI_HEADER_MULTI_FUNC))
+        maxfunc = 7;
+
+      struct pci_entry e;
+
+      e.cfg_address = addr;
+      e.vendor_id   = id & 0xFFFF;
+      e.device_id   = id >> 16;
+      e.class_rev   = pci_read_uint32(addr + PCI_CFG_REVID);
+      e.header_type = type;
+      e.secondary_bus = e.subordinate_bus = 0;
+
+      if (((type & PCI_HEADER_TYPE_MASK) == PCI_HEADER_BRIDGE) ||
+          ((type & PCI_HEADER_TYPE_MASK) == PCI_HEADER_CARDBUS)) {
+        uint32_t buses = pci_read_uint32(addr + PCI_CFG_BUS_NUMBERS);
+
+        e.secondary_bus   = buses >> 8;
+        e.subordinate_bus = buses >> 16;
+      }
+
+      /* A full table is no reason not to boot. */
+      if (t->count < PCI_MAX_DEVICES)
+        t->dev[t->count++] = e;
+      else
+        pci_dropped++;
+
+      /* Bus 0 behind a bridge means it is not configured. */
+      if (e.secondary_bus)
+        pci_scan_bus(t, e.secondary_bus);
+    }
+  }
+}
+
+/**
+ * Walk the bus hierarchy from bus 0 instead of probing all 256
+ * buses. A multi-function host bridge at 00:00.0 has another root
+ * bus for each further host bridge function. Root buses that neither
+ * lead to, like the one of a second socket, are found by probing
+ * device 0 of every bus that was not reached.
+ */
+static const struct pci_table *
+pci_enumerate(void)
+{
+  struct pci_table *t = &pci_scan_buf.table;
+
+  t->magic = PCI_TABLE_MAGIC;
+  t->count = 0;
+
+  pci_scan_bus(t, 0);
+
+  if (pci_read_uint8(0x80000000 + PCI_CFG_HEADER_TYPE) & PCI_HEADER_MULTI_FUNC)
+    for (unsigned func = 1; func < 8; func++) {
+      uint32_t addr = 0x80000000 | func << 8;
+
+      if (((pci_read_uint32(addr + PCI_CFG_VENDOR_ID) & 0xFFFF) != 0xFFFF) &&
+          ((pci_read_uint32(addr + PCI_CFG_REVID) >> 16) ==
+           ((PCI_CLASS_BRIDGE_DEV << 8) | PCI_SUBCLASS_HOST_BRIDGE)))
+        pci_scan_bus(t, func);
+    }
+
+  for (unsigned bus = 1; bus < 256; bus++)
+    if (!(pci_scanned_buses[bus / 32] & (1U << (bus % 32))) &&
+        ((pci_read_uint32(0x80000000 | bus << 16 | PCI_CFG_VENDOR_ID) & 0xFFFF) != 0xFFFF))
+      pci_scan_bus(t, bus);
+
+  if (pci_dropped)
+    printf("PCI: table full, %u functions left out.\n", pci_dropped);
+
+  /* Sort by address, as the lookups have always been. */
+  for (unsigned i = 1; i < t->count; i++) {
+    struct pci_entry e = t->dev[i];
+    unsigned j = i;
+
+    for (; (j > 0) && (t->dev[j - 1].cfg_address > e.cfg_address); j--)
+      t->dev[j] = t->dev[j - 1];
+    t->dev[j] = e;
+  }
+
+  return t;
+}
+
+/** Returns a table left in the memory map by an earlier stage. */
+static const struct pci_table *
+pci_find_table(const struct mbi *mbi)
+{
+  if (!(mbi->flags & MBI_FLAG_MMAP))
+    return NULL;
+
+  for (memory_map_t *mmap = (memory_map_t *)mbi->mmap_addr;
+       (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+       mmap = (memory_map_t *)(mmap->size + (uint32_t)mmap + sizeof(mmap->size))) {
+    const struct pci_table *t = (const struct pci_table *)mmap->base_addr_low;
+    uint64_t len = (uint64_t)mmap->length_high << 32 | mmap->length_low;
+
+    if ((mmap->type == MMAP_PCI_TABLE) && (mmap->base_addr_high == 0) &&
+        (len >= sizeof(*t)) && (t->magic == PCI_TABLE_MAGIC) &&
+        (t->count <= (len - sizeof(*t)) / sizeof(t->dev[0])))
+      return t;
+  }
+
+  return NULL;
+}
+
+/**
+ * Copy the table to protected memory and describe it with a reserved
+ * memory map entry. The memory map is copied along to make room for
+ * the new entry.
+ */
+static const struct pci_table *
+pci_publish(struct mbi *mbi, const struct pci_table *t)
+{
+  size_t tlen = sizeof(*t) + t->count * sizeof(t->dev[0]);
+  size_t len  = tlen + mbi->mmap_length + sizeof(memory_map_t);
+
+  /* This shrinks an entry of the old map, so copy that afterwards. */
+  uint8_t *p = mbi_alloc_protected_memory(mbi, len, 4);
+  memory_map_t *mmap = (memory_map_t *)(p + tlen);
+  memory_map_t *e = (memory_map_t *)((uint8_t *)mmap + mbi->mmap_length);
+
+  memcpy(p, t, tlen);
+  memcpy(mmap, (const void *)mbi->mmap_addr, mbi->mmap_length);
+
+  e->size           = sizeof(*e) - sizeof(e->size);
+  e->base_addr_low  = (uint32_t)p;
+  e->base_addr_high = 0;
+  e->length_low     = len;
+  e->length_high    = 0;
+  e->type           = MMAP_PCI_TABLE;
+
+  mbi->mmap_addr    = (uint32_t)mmap;
+  mbi->mmap_length += sizeof(*e);
+
+  return (const struct pci_table *)p;
+}
+
 void
-populate_device_info(uint32_t cfg_address, struct pci_device *dev)
+pci_init(struct mbi *mbi)
+{
+  if (pci_table)
+    return;
+
+  if (pci_ecam_init())
+    printf("PCI config space is memory-mapped at %p.\n", pci_ecam);
+
+  pci_table = pci_find_table(mbi);
+  if (pci_table)
+    return;
+
+  pci_table = pci_enumerate();
+  if (mbi->flags & MBI_FLAG_MMAP)
+    pci_table = pci_publish(mbi, pci_table);
+}
+
+const struct pci_table *
+pci_devices(void)
 {
-  uint32_t vendor_id = pci_read_uint32(cfg_address + PCI_CFG_VENDOR_ID);
-  uint32_t device_id = vendor_id >> 16;
-  vendor_id &= 0xFFFF;
-  
-  dev->db = pci_lookup_device(vendor_id, device_id);
-  dev->cfg_address = cfg_address;
+  if (!pci_table)
+    pci_table = pci_enumerate();
+
+  return pci_table;
 }
 
+unsigned
+pci_find_devices_by_class(uint8_t class, uint8_t subclass,
+                          struct pci_device *devs, unsigned max)
+{
+  const struct pci_table *t = pci_devices();
+  uint16_t full_class = class << 8 | subclass;
+  uint16_t class_mask = (subclass == PCI_SUBCLASS_ANY) ? 0xFF00 : 0xFFFF;
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < t->count; i++)
+    if ((full_class & class_mask) == ((t->dev[i].class_rev >> 16) & class_mask)) {
+      if (n < max)
+        populate_device_info(&t->dev[i], &devs[n]);
+      n++;
+    }
+
+  return n;
+}
 
 bool
 pci_find_device_by_class(uint8_t class, uint8_t subclass,
 			 struct pci_device *dev)
 {
-  uint32_t res = 0;
+  const struct pci_table *t = pci_devices();
+  const struct pci_entry *res = NULL;
   uint16_t full_class = class << 8 | subclass;
   uint16_t class_mask = (subclass == PCI_SUBCLASS_ANY) ? 0xFF00 : 0xFFFF;
 
   assert(dev != NULL, "Invalid dev pointer");
 
-  for (unsigned i=0; i<1<<13; i++) {
-    uint8_t maxfunc = 0;
-    
-    for (unsigned func = 0; func <= maxfunc; func++) {
-      uint32_t addr = 0x80000000 | i<<11 | func<<8;
-
-      if (!maxfunc && pci_read_uint8(addr+14) & 0x80)
-	maxfunc=7;
+  for (unsigned i = 0; i < t->count; i++)
+    if ((full_class & class_mask) == ((t->dev[i].class_rev >> 16) & class_mask))
+      res = &t->dev[i];
 
-      if ((full_class & class_mask) == ((pci_read_uint32(addr+0x8) >> 16) & class_mask))
-	res = addr;
-    }
-  }
-
-  if (res != 0) {
+  if (res != NULL) {
     populate_device_info(res, dev);
     return true;
   } else {
@@ -107,6 +461,172 @@ pci_find_cap(unsigned addr, unsigned char id)
   return 0;
 }
 
+uint32_t
+pci_upstream_bridge(unsigned addr)
+{
+  const struct pci_table *t = pci_devices();
+  unsigned bus = (addr >> 16) & 0xFF;
+
+  for (unsigned i = 0; bus && (i < t->count); i++)
+    if ((t->dev[i].secondary_bus == bus) &&
+        ((t->dev[i].header_type & PCI_HEADER_TYPE_MASK) == PCI_HEADER_BRIDGE))
+      return t->dev[i].cfg_address;
+
+  return 0;
+}
+
+static void
+pci_print_bdf(unsigned addr)
+{
+  printf("%02x:%02x.%x", (addr >> 16) & 0xFF, (addr >> 11) & 0x1F, (addr >> 8) & 7);
+}
+
+/** Cache line size in dwords, as the CPU reports it for CLFLUSH. */
+static uint8_t
+pci_cache_line(void)
+{
+  uint32_t eax = 1, ebx;
+  asm ("cpuid" : "+a" (eax), "=b" (ebx) :: "ecx", "edx");
+
+  uint8_t dwords = ((ebx >> 8) & 0xFF) * 2;
+  return dwords ? dwords : 16;
+}
+
+/* Set Max_Payload_Size of a PCIe function, if it is lower. */
+static void
+pcie_raise_payload(unsigned addr, unsigned cap, unsigned mps)
+{
+  uint16_t ctl = pci_read_uint16(addr + cap + PCI_EXP_DEVCTL);
+  unsigned cur = (ctl & PCI_EXP_DEVCTL_PAYLOAD) >> 5;
+
+  if (cur >= mps)
+    return;
+
+  pci_write_uint16(addr + cap + PCI_EXP_DEVCTL, (ctl & ~PCI_EXP_DEVCTL_PAYLOAD) | mps << 5);
+  printf("PCI: ");
+  pci_print_bdf(addr);
+  printf(" Max Payload %u -> %u.\n", 128 << cur, 128 << mps);
+}
+
+/* Conventional PCI wants cache line size and latency timer set for
+   efficient bursts. */
+static void
+pci_tune_conventional(unsigned addr, bool bridge)
+{
+  uint8_t line = pci_cache_line();
+  uint8_t regs[] = { PCI_CFG_LATENCY, PCI_CFG_SEC_LATENCY };
+
+  if (pci_read_uint8(addr + PCI_CFG_CACHE_LINE) != line) {
+    pci_write_uint8(addr + PCI_CFG_CACHE_LINE, line);
+    printf("PCI: ");
+    pci_print_bdf(addr);
+    printf(" cache line size %u bytes.\n", line * 4);
+  }
+
+  for (unsigned i = 0; i < (bridge ? 2 : 1); i++) {
+    uint8_t latency = pci_read_uint8(addr + regs[i]);
+
+    if (latency < PCI_MIN_LATENCY) {
+      pci_write_uint8(addr + regs[i], PCI_MIN_LATENCY);
+      printf("PCI: ");
+      pci_print_bdf(addr);
+      printf(" %slatency timer %u -> %u.\n", i ? "secondary " : "", latency, PCI_MIN_LATENCY);
+    }
+  }
+}
+
+/**
+ * Walk from the device up to its root port. Max Payload Size has to
+ * match on both ends of every link, so it is raised to what every
+ * PCIe function below the root port supports, not only the ones on
+ * our path. Max Read Request Size only concerns the device itself.
+ */
+void
+pci_tune_path(unsigned addr)
+{
+  enum { MAX_DEPTH = 16 };
+  uint32_t path[MAX_DEPTH];
+  unsigned depth = 0;
+
+  for (uint32_t a = addr; a && (depth < MAX_DEPTH); a = pci_upstream_bridge(a))
+    path[depth++] = a;
+
+  uint32_t root = 0;
+  unsigned root_cap = 0;
+  bool reported = false;
+
+  for (unsigned i = 0; i < depth; i++) {
+    unsigned cap = pci_find_cap(path[i], PCI_CAP_ID_EXP);
+
+    if (!cap) {
+      pci_tune_conventional(path[i], i > 0);
+      continue;
+    }
+
+    /* The bridge to conventional PCI runs the bus below. */
+    if (((pci_read_uint16(path[i] + cap + PCI_EXP_FLAGS) >> 4) & 0xF) == PCI_EXP_TYPE_PCI_BRIDGE)
+      pci_tune_conventional(path[i], true);
+
+    if (!reported) {
+      uint32_t lnkcap = pci_read_uint32(path[i] + cap + PCI_EXP_LNKCAP);
+      uint16_t lnksta = pci_read_uint16(path[i] + cap + PCI_EXP_LNKSTA);
+
+      printf("PCI: ");
+      pci_print_bdf(path[i]);
+      printf(" link x%u Gen%u (supports x%u Gen%u).\n", (lnksta >> 4) & 0x3F, lnksta & 0xF,
+             (lnkcap >> 4) & 0x3F, lnkcap & 0xF);
+      reported = true;
+    }
+
+    root = path[i];
+    root_cap = cap;
+  }
+
+  if (!root ||
+      (((pci_read_uint16(root + root_cap + PCI_EXP_FLAGS) >> 4) & 0xF) != PCI_EXP_TYPE_ROOT_PORT)) {
+    printf("PCI: No root port found. Leaving payload size alone.\n");
+    return;
+  }
+
+  const struct pci_table *t = pci_devices();
+  uint8_t first = pci_read_uint8(root + PCI_CFG_BUS_NUMBERS + 1);
+  uint8_t last  = pci_read_uint8(root + PCI_CFG_BUS_NUMBERS + 2);
+  unsigned mps  = pci_read_uint32(root + root_cap + PCI_EXP_DEVCAP) & PCI_EXP_DEVCAP_PAYLOAD;
+
+  for (unsigned i = 0; i < t->count; i++) {
+    unsigned bus = (t->dev[i].cfg_address >> 16) & 0xFF;
+    unsigned cap;
+
+    if ((bus >= first) && (bus <= last) &&
+        (cap = pci_find_cap(t->dev[i].cfg_address, PCI_CAP_ID_EXP)))
+      mps = MIN(mps, pci_read_uint32(t->dev[i].cfg_address + cap + PCI_EXP_DEVCAP) &
+                PCI_EXP_DEVCAP_PAYLOAD);
+  }
+
+  pcie_raise_payload(root, root_cap, mps);
+  for (unsigned i = 0; i < t->count; i++) {
+    unsigned bus = (t->dev[i].cfg_address >> 16) & 0xFF;
+    unsigned cap;
+
+    if ((bus >= first) && (bus <= last) &&
+        (cap = pci_find_cap(t->dev[i].cfg_address, PCI_CAP_ID_EXP)))
+      pcie_raise_payload(t->dev[i].cfg_address, cap, mps);
+  }
+
+  unsigned cap = pci_find_cap(addr, PCI_CAP_ID_EXP);
+  if (cap) {
+    uint16_t ctl = pci_read_uint16(addr + cap + PCI_EXP_DEVCTL);
+    unsigned cur = (ctl & PCI_EXP_DEVCTL_READRQ) >> 12;
+
+    if (cur < PCI_EXP_READRQ_4096) {
+      pci_write_uint16(addr + cap + PCI_EXP_DEVCTL,
+                       (ctl & ~PCI_EXP_DEVCTL_READRQ) | PCI_EXP_READRQ_4096 << 12);
+      printf("PCI: ");
+      pci_print_bdf(addr);
+      printf(" Max Read Request %u -> %u.\n", 128 << cur, 128 << PCI_EXP_READRQ_4096);
+    }
+  }
+}
 
 uint32_t
 pci_cfg_read_uint32(const struct pci_device *dev, uint32_t offset)
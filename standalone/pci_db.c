@@ -5,19 +5,25 @@
 #define WILDCARD 0xFFFF
 
 /* This list is searched from top to bottom. Wildcards always
-   match. */
+   match. Wildcard entries keep the conservative defaults. max_rec 10
+   is 2048 byte payloads, the most S400 can carry. */
 static const struct pci_db_entry vendor_db[] = {
   /* Texas Instruments */
-  { 0x104c,   0x8023,   NO_QUIRKS, "Texas Instruments IEEE1394a-2000 OHCI PHY/Link-Layer Ctrlr" },
-  { 0x104c,   0x8235,   NO_QUIRKS, "Texas Instruments XIO2200(A) IEEE-1394a-2000 Controller (PHY/Link)" },
-  { 0x104c,   WILDCARD, NO_QUIRKS, "Texas Instruments Unknown Device" },
+  { 0x104c,   0x8023,   QUIRK_POSTED_WRITES_OK | QUIRK_CROM_SWAP, 10,
+    "Texas Instruments IEEE1394a-2000 OHCI PHY/Link-Layer Ctrlr" },
+  { 0x104c,   0x8025,   QUIRK_NO_1394A | QUIRK_CROM_SWAP, 0,
+    "Texas Instruments TSB82AA2 IEEE-1394b Link Layer Controller" },
+  { 0x104c,   0x8235,   QUIRK_POSTED_WRITES_OK | QUIRK_CROM_SWAP, 10,
+    "Texas Instruments XIO2200(A) IEEE-1394a-2000 Controller (PHY/Link)" },
+  { 0x104c,   WILDCARD, QUIRK_CROM_SWAP, 0, "Texas Instruments Unknown Device" },
   /* NEC */
-  { 0x1033,   0x00e7,   NO_QUIRKS, "NEC Electronics IEEE1394 OHCI 1.1 2-port PHY-Link Ctrlr" },
-  { 0x1033,   WILDCARD, NO_QUIRKS, "NEC Electronics Unknown Device" },
+  { 0x1033,   0x00e7,   QUIRK_POSTED_WRITES_OK | QUIRK_CROM_SWAP, 10,
+    "NEC Electronics IEEE1394 OHCI 1.1 2-port PHY-Link Ctrlr" },
+  { 0x1033,   WILDCARD, QUIRK_CROM_SWAP, 0, "NEC Electronics Unknown Device" },
   /* JMicron */
-  { 0x197b,   0x2380,   NO_QUIRKS, "JMicron Technology Corp. IEEE 1394 Host Controller"},
+  { 0x197b,   0x2380,   QUIRK_CROM_SWAP, 10, "JMicron Technology Corp. IEEE 1394 Host Controller"},
   /* Unknown (don't remove this item) */
-  { WILDCARD, WILDCARD, NO_QUIRKS, "Unknown Device" }
+  { WILDCARD, WILDCARD, QUIRK_CROM_SWAP, 0, "Unknown Device" }
 };
 
 const struct pci_db_entry *
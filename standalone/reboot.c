@@ -9,7 +9,7 @@ kb_wait(void)
   for (int i = 0; i < 0x10000; i++) {
     if ((inb(0x64) & 0x02) == 0)
       break;
-    wait(1);
+    udelay(2);
   }
 }
 
@@ -19,8 +19,9 @@ reboot(void)
   out_string("Reset!\n");
   for (int i = 0; i < 10; i++) {
     kb_wait();
+    udelay(50);
     outb(0x64, 0xFE); /* pulse reset low */
-    wait(1);
+    udelay(50);
   }
 
   /* If we get here, reboot didn't work... */
@@ -0,0 +1,251 @@
+/* -*- Mode: C -*- */
+/*
+ * Application processor work pool.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <stdint.h>
+#include <util.h>
+#include <cpuid.h>
+#include <smp.h>
+#include <mbi-tools.h>
+
+/* Keep these and SMP_TRAMPOLINE in sync with smp_start.asm. */
+enum {
+  SMP_STACK_SHIFT = 15,
+  SMP_STACK_SIZE  = 1 << SMP_STACK_SHIFT,
+};
+
+enum {
+  APIC_X2APIC_ENABLE = 1 << 10,
+
+  APIC_SVR           = 0xF0,
+  APIC_ICR_LOW       = 0x300,
+  APIC_ICR_HIGH      = 0x310,
+
+  APIC_SVR_ENABLE    = 1 << 8,
+
+  ICR_INIT           = 5 << 8,
+  ICR_STARTUP        = 6 << 8,
+  ICR_PENDING        = 1 << 12,
+  ICR_ASSERT         = 1 << 14,
+  ICR_LEVEL          = 1 << 15,
+  ICR_ALL_BUT_SELF   = 3 << 18,
+};
+
+extern const char smp_trampoline[], smp_trampoline_end[];
+
+/* Used by smp_start.asm. APs wait for smp_ap_go, before they take
+   one of smp_ap_max stacks at smp_ap_stacks. */
+volatile unsigned smp_ap_next;
+volatile unsigned smp_ap_go;
+unsigned smp_ap_max;
+uint8_t *smp_ap_stacks;
+
+static volatile uint32_t *smp_apic;
+static unsigned smp_aps;
+static unsigned smp_stack_count;
+
+static uint32_t apic_svr;
+static unsigned apic_svr_users;
+
+static struct {
+  smp_job_fn job;
+  void *arg;
+  unsigned count;
+
+  volatile unsigned generation;
+  volatile unsigned next;
+  volatile unsigned busy;     /* APs that have not finished this round */
+} smp_work;
+
+static void
+apic_send_ipi(uint32_t icr)
+{
+  smp_apic[APIC_ICR_HIGH / 4] = 0;
+  smp_apic[APIC_ICR_LOW / 4]  = icr;
+
+  while (smp_apic[APIC_ICR_LOW / 4] & ICR_PENDING)
+    asm volatile ("pause");
+}
+
+/** Run jobs of the current round until none are left. */
+static void
+smp_work_run(void)
+{
+  unsigned i;
+
+  while ((i = __sync_fetch_and_add(&smp_work.next, 1)) < smp_work.count)
+    smp_work.job(i, smp_work.arg);
+}
+
+void __attribute__((regparm(3), noreturn))
+smp_ap_main(unsigned cpu)
+{
+  unsigned seen = 0;
+
+  /* SSE state is per processor. */
+  enable_sse();
+
+  for (;;) {
+    while (smp_work.generation == seen)
+      asm volatile ("pause");
+
+    seen = smp_work.generation;
+    memory_barrier();
+
+    smp_work_run();
+    __sync_fetch_and_sub(&smp_work.busy, 1);
+  }
+}
+
+/**
+ * Wake all application processors with INIT-SIPI-SIPI and let them
+ * wait for work. Their stacks come from memory that mbi leaves
+ * free. Returns the number of processors that came up.
+ */
+unsigned
+smp_init(const struct mbi *mbi)
+{
+  static uint8_t saved[0x1000];
+  size_t len = smp_trampoline_end - smp_trampoline;
+  uint32_t hi, low;
+
+  if (smp_apic)
+    return smp_aps;
+
+  if (!has_apic())
+    enable_apic();
+
+  if (!has_apic())
+    return 0;
+
+  asm ("rdmsr" : "=d" (hi), "=a" (low) : "c" (IA32_APIC_BASE));
+
+  /* We only talk to the xAPIC MMIO interface. */
+  if (low & APIC_X2APIC_ENABLE)
+    return 0;
+
+  smp_apic = (volatile uint32_t *)(low & APIC_PHYS_BASE_MASK);
+  apic_svr_take(smp_apic);
+  smp_apic[APIC_SVR / 4] |= APIC_SVR_ENABLE;
+
+  /* The trampoline page may belong to someone else. */
+  memcpy(saved, (void *)SMP_TRAMPOLINE, len);
+  memcpy((void *)SMP_TRAMPOLINE, smp_trampoline, len);
+
+  apic_send_ipi(ICR_ALL_BUT_SELF | ICR_INIT | ICR_ASSERT);
+  wait(10);
+  apic_send_ipi(ICR_ALL_BUT_SELF | ICR_STARTUP | (SMP_TRAMPOLINE >> 12));
+  wait(1);
+  apic_send_ipi(ICR_ALL_BUT_SELF | ICR_STARTUP | (SMP_TRAMPOLINE >> 12));
+
+  /* We don't know how many processors there are. Wait until no new
+     ones show up. */
+  unsigned up;
+  do {
+    up = smp_ap_next;
+    wait(10);
+  } while (up != smp_ap_next);
+
+  memcpy((void *)SMP_TRAMPOLINE, saved, len);
+
+  /* Stacks are kept for later rounds. If memory is short, fewer
+     processors get one. */
+  for (unsigned n = up; n > smp_stack_count; n /= 2) {
+    uint8_t *stacks = mbi_alloc_scratch(mbi, n * SMP_STACK_SIZE);
+    if (stacks) {
+      smp_ap_stacks   = stacks;
+      smp_stack_count = n;
+      break;
+    }
+  }
+
+  smp_aps = smp_ap_max = MIN(up, smp_stack_count);
+
+  /* Publish the stacks before the go. */
+  memory_barrier();
+  smp_ap_go = 1;
+
+  return smp_aps;
+}
+
+/**
+ * Call job for each index below count on all processors including
+ * our own and wait until all of them are done.
+ */
+void
+smp_for_each(unsigned count, smp_job_fn job, void *arg)
+{
+  smp_work.job   = job;
+  smp_work.arg   = arg;
+  smp_work.count = count;
+  smp_work.next  = 0;
+  smp_work.busy  = smp_aps;
+
+  /* Publish the job before the new round. */
+  memory_barrier();
+  smp_work.generation++;
+
+  /* Unlike the APs, we look after background work between jobs. */
+  unsigned i;
+  while ((i = __sync_fetch_and_add(&smp_work.next, 1)) < smp_work.count) {
+    smp_work.job(i, smp_work.arg);
+    background_poll();
+  }
+
+  while (smp_work.busy) {
+    background_poll();
+    asm volatile ("pause");
+  }
+}
+
+/**
+ * Put all application processors back into wait-for-SIPI, so the OS
+ * we boot finds them the way the BIOS left them.
+ */
+void
+smp_park(void)
+{
+  if (!smp_apic)
+    return;
+
+  apic_send_ipi(ICR_ALL_BUT_SELF | ICR_INIT | ICR_ASSERT);
+  wait(10);
+  apic_send_ipi(ICR_ALL_BUT_SELF | ICR_INIT | ICR_LEVEL);
+
+  apic_svr_release(smp_apic);
+
+  smp_apic    = NULL;
+  smp_aps     = 0;
+  smp_ap_next = 0;
+  smp_ap_go   = 0;
+}
+
+void
+apic_svr_take(volatile uint32_t *apic)
+{
+  if (apic_svr_users++ == 0)
+    apic_svr = apic[APIC_SVR / 4];
+}
+
+void
+apic_svr_release(volatile uint32_t *apic)
+{
+  if (--apic_svr_users == 0)
+    apic[APIC_SVR / 4] = apic_svr;
+}
+
+/* EOF */
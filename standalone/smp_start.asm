@@ -0,0 +1,81 @@
+        ;; Real mode entry point of application processors. The BSP
+        ;; copies this code to SMP_TRAMPOLINE and points the startup
+        ;; IPIs at it. Keep this in sync with smp.c.
+
+        CPU P3
+
+        EXTERN smp_ap_main, smp_ap_next, smp_ap_go, smp_ap_max, smp_ap_stacks
+        GLOBAL smp_trampoline, smp_trampoline_end
+
+SMP_TRAMPOLINE  equ 7000h
+SMP_STACK_SHIFT equ 15
+
+%define TRAMPOLINE(label) (SMP_TRAMPOLINE + (label - smp_trampoline))
+
+        SECTION .text.smp_trampoline EXEC NOWRITE ALIGN=16
+        BITS 16
+smp_trampoline:
+        cli
+        cld
+        mov     ax, cs
+        mov     ds, ax
+        o32 lgdt [gdt_ptr - smp_trampoline]
+
+        mov     eax, cr0
+        or      al, 1
+        mov     cr0, eax
+        jmp     dword 8h:TRAMPOLINE(protected)
+
+        BITS 32
+protected:
+        mov     eax, 10h
+        mov     ds, ax
+        mov     es, ax
+        mov     fs, ax
+        mov     gs, ax
+        mov     ss, ax
+
+        ;; Leave the trampoline page right away. smp_init() gives it
+        ;; back to its owner.
+        mov     ecx, smp_ap_start
+        jmp     ecx
+
+        align 4
+gdt_ptr:
+        dw      gdt_end - gdt - 1
+        dd      gdt
+smp_trampoline_end:
+
+        SECTION .text.smp_ap_start EXEC NOWRITE ALIGN=16
+smp_ap_start:
+        ;; Take a number and wait until smp_init() knows how many
+        ;; stacks there are. Surplus processors stay halted here until
+        ;; the INIT IPI of smp_park().
+        mov     eax, 1
+        lock xadd [smp_ap_next], eax
+.wait:
+        pause
+        cmp     dword [smp_ap_go], 0
+        je      .wait
+        cmp     eax, [smp_ap_max]
+        jae     smp_ap_halt
+
+        lea     esp, [eax + 1]
+        shl     esp, SMP_STACK_SHIFT
+        add     esp, [smp_ap_stacks]
+        call    smp_ap_main
+
+smp_ap_halt:
+        cli
+        hlt
+        jmp     smp_ap_halt
+
+        SECTION .rodata
+        align 8
+gdt:
+        dq      0
+        dq      00CF9A000000FFFFh ; flat code
+        dq      00CF92000000FFFFh ; flat data
+gdt_end:
+
+        ;; EOF
@@ -2,7 +2,7 @@
 
         CPU P3
         
-        EXTERN main, __exit
+        EXTERN main, __exit, mem_init
         GLOBAL _mbheader, _start, jmp_multiboot
         
         SECTION .text._start EXEC NOWRITE ALIGN=4
@@ -14,6 +14,9 @@ _mbheader:
 
 _start:
         mov     esp, _stack
+        push    eax
+        call    mem_init
+        pop     eax
         mov     edx, ebx
         push    __exit
         jmp      main
@@ -24,7 +27,7 @@ jmp_multiboot:
         jmp     edx
         
         SECTION .bss
-        resb 4096
+        resb 32768
 _stack: 
         
         ;; EOF
\ No newline at end of file
@@ -45,19 +45,20 @@
 #define FNAME    8
 #define FCOMMENT 16
 
-/* If dest is NULL, return uncompressed length in *destLen. */
-int tinf_gzip_uncompress(void *dest, unsigned int *destLen,
-                         const void *source, unsigned int sourceLen)
+/* Check the gzip header and return its length in *headerLen, the
+   deflate data follows it. Only looks at the first sourceLen bytes. */
+int tinf_gzip_header(const void *source, unsigned int sourceLen,
+                     unsigned int *headerLen)
 {
     unsigned char *src = (unsigned char *)source;
-    unsigned char *dst = (unsigned char *)dest;
+    unsigned char *end = src + sourceLen;
     unsigned char *start;
-    unsigned int dlen, crc32;
-    int res;
     unsigned char flg;
 
     /* -- check format -- */
 
+    if (sourceLen < 10) return TINF_DATA_ERROR;
+
     /* check id bytes */
     if (src[0] != 0x1f || src[1] != 0x8b) return TINF_DATA_ERROR;
 
@@ -78,21 +79,34 @@ int tinf_gzip_uncompress(void *dest, unsigned int *destLen,
     /* skip extra data if present */
     if (flg & FEXTRA)
     {
-       unsigned int xlen = start[1];
+       unsigned int xlen;
+       if (end - start < 2) return TINF_DATA_ERROR;
+       xlen = start[1];
        xlen = 256*xlen + start[0];
+       if ((unsigned int)(end - start) < xlen + 2) return TINF_DATA_ERROR;
        start += xlen + 2;
     }
 
     /* skip file name if present */
-    if (flg & FNAME) { while (*start) ++start; ++start; }
+    if (flg & FNAME)
+    {
+       while (start < end && *start) ++start;
+       if (start++ == end) return TINF_DATA_ERROR;
+    }
 
     /* skip file comment if present */
-    if (flg & FCOMMENT) { while (*start) ++start; ++start; }
+    if (flg & FCOMMENT)
+    {
+       while (start < end && *start) ++start;
+       if (start++ == end) return TINF_DATA_ERROR;
+    }
 
     /* check header crc if present */
     if (flg & FHCRC)
     {
-       unsigned int hcrc = start[1];
+       unsigned int hcrc;
+       if (end - start < 2) return TINF_DATA_ERROR;
+       hcrc = start[1];
        hcrc = 256*hcrc + start[0];
 
        if (hcrc != (tinf_crc32(src, start - src) & 0x0000ffff))
@@ -101,6 +115,27 @@ int tinf_gzip_uncompress(void *dest, unsigned int *destLen,
        start += 2;
     }
 
+    *headerLen = start - src;
+
+    return TINF_OK;
+}
+
+/* If dest is NULL, return uncompressed length in *destLen. */
+int tinf_gzip_uncompress(void *dest, unsigned int *destLen,
+                         const void *source, unsigned int sourceLen)
+{
+    unsigned char *src = (unsigned char *)source;
+    unsigned char *dst = (unsigned char *)dest;
+    unsigned char *start;
+    unsigned int hlen, dlen, crc32, sum;
+    int res;
+
+    res = tinf_gzip_header(src, sourceLen, &hlen);
+
+    if (res != TINF_OK || sourceLen - hlen < 8) return TINF_DATA_ERROR;
+
+    start = src + hlen;
+
     /* -- get decompressed length -- */
 
     dlen =            src[sourceLen - 1];
@@ -122,7 +157,8 @@ int tinf_gzip_uncompress(void *dest, unsigned int *destLen,
 
     /* -- decompress data -- */
 
-    res = tinf_uncompress(dst, destLen, start, src + sourceLen - start - 8);
+    res = tinf_uncompress_sum(dst, destLen, start, src + sourceLen - start - 8,
+                              TINF_SUM_CRC32, &sum);
 
     if (res != TINF_OK) return TINF_DATA_ERROR;
 
@@ -130,7 +166,7 @@ int tinf_gzip_uncompress(void *dest, unsigned int *destLen,
 
     /* -- check CRC32 checksum -- */
 
-    if (crc32 != tinf_crc32(dst, dlen)) return TINF_DATA_ERROR;
+    if (crc32 != sum) return TINF_DATA_ERROR;
 
     return TINF_OK;
 }
@@ -33,6 +33,37 @@
 
 #include "tinf.h"
 
+/* Define TINF_SMALL to build without the symbol lookup tables. Symbols
+ * are then decoded one bit at a time, which is slow but saves about
+ * 8k of memory. */
+
+/* number of bits resolved by the first-level lookup table */
+#define TINF_FAST_BITS 9
+
+/* size of the lookup tables including all second-level tables, this
+ * is the worst case for 286 symbols with 15 bit codes (see zlib's
+ * ENOUGH_LENS) */
+#define TINF_FAST_SIZE 852
+
+/* lookup table entries: code length in bits 0-3, symbol above */
+#define TINF_FAST_ENTRY(sym, len) (((sym) << 4) | (len))
+
+/* link to a second-level table: index in bits 4-14, its size in bits
+ * 0-3 */
+#define TINF_FAST_LINK 0x8000
+
+/* output is checksummed in pieces of this size, while it is still in
+ * the cache */
+#define TINF_SUM_WINDOW 32768
+
+/* bit buffer, as wide as a register (32 bits on i386) */
+typedef unsigned long TINF_BITBUF;
+
+#define TINF_BITBUF_BITS (8 * sizeof(TINF_BITBUF))
+
+/* unaligned view of the source for refilling the bit buffer */
+typedef TINF_BITBUF __attribute__((may_alias, aligned(1))) TINF_UNALIGNED_BITBUF;
+
 /* ------------------------------ *
  * -- internal data structures -- *
  * ------------------------------ */
@@ -40,18 +71,28 @@
 typedef struct {
    unsigned short table[16];  /* table of code length counts */
    unsigned short trans[288]; /* code -> symbol translation table */
+#ifndef TINF_SMALL
+   unsigned short fast_bits;  /* first-level table bits (0: use slow path) */
+   unsigned short fast[TINF_FAST_SIZE]; /* bit pattern -> symbol lookup */
+#endif
 } TINF_TREE;
 
 typedef struct {
    const unsigned char *source;
-   unsigned int tag;
+   const unsigned char *source_end;
+   TINF_BITBUF tag;
    unsigned int bitcount;
 
    unsigned char *dest;
    unsigned int *destLen;
 
+   int sum;                  /* TINF_SUM_* */
+   unsigned int checksum;
+   unsigned char *sum_dest;  /* output up to here is checksummed */
+
    TINF_TREE ltree; /* dynamic length/symbol tree */
    TINF_TREE dtree; /* dynamic distance tree */
+   TINF_TREE ctree; /* code length tree */
 } TINF_DATA;
 
 /* --------------------------------------------------- *
@@ -97,6 +138,98 @@ static void tinf_build_bits_base(unsigned char *bits, unsigned short *base, int
    }
 }
 
+#ifndef TINF_SMALL
+
+/* reverse the lowest len bits of code */
+static unsigned int tinf_reverse_bits(unsigned int code, unsigned int len)
+{
+   unsigned int rev = 0;
+
+   for (; len; --len, code >>= 1) rev = (rev << 1) | (code & 1);
+
+   return rev;
+}
+
+/* build lookup tables from the code length counts and the sorted
+ * symbols of a tree, falls back to the slow decoder for codes that
+ * do not fit */
+static void tinf_build_fast(TINF_TREE *t)
+{
+   unsigned short left[16];
+   unsigned int len, maxlen, root, used, i, j;
+   unsigned int code = 0, sym = 0, group = ~0u, sub = 0, subbits = 0;
+
+   for (maxlen = 0, len = 1; len < 16; ++len)
+   {
+      left[len] = t->table[len];
+      if (t->table[len]) maxlen = len;
+   }
+
+   root = maxlen < TINF_FAST_BITS ? maxlen : TINF_FAST_BITS;
+   if (root == 0) root = 1;
+
+   /* unused entries stay zero and decode as an error */
+   used = 1 << root;
+   for (i = 0; i < used; ++i) t->fast[i] = 0;
+
+   t->fast_bits = 0;
+
+   /* walk the canonical codes in order, the bit stream holds them
+    * starting with the most significant bit, so index by their
+    * reversed value */
+   for (len = 1; len <= maxlen; ++len, code <<= 1)
+   {
+      for (i = 0; i < t->table[len]; ++i, ++code, ++sym, --left[len])
+      {
+         unsigned int rev = tinf_reverse_bits(code, len);
+         unsigned int entry = TINF_FAST_ENTRY(t->trans[sym], len);
+
+         /* over-subscribed code */
+         if (code >= (1u << len)) return;
+
+         if (len <= root)
+         {
+            for (j = rev; j < (1u << root); j += 1u << len) t->fast[j] = entry;
+            continue;
+         }
+
+         if ((rev & ((1u << root) - 1)) != group)
+         {
+            int room;
+
+            /* start a second-level table, it is just large enough to
+             * hold the codes sharing this prefix */
+            group = rev & ((1u << root) - 1);
+
+            for (subbits = len - root, room = 1 << subbits;
+                 subbits + root < maxlen; ++subbits, room <<= 1)
+            {
+               room -= left[subbits + root];
+               if (room <= 0) break;
+            }
+
+            if (used + (1u << subbits) > TINF_FAST_SIZE) return;
+
+            t->fast[group] = TINF_FAST_LINK | (used << 4) | subbits;
+            sub = used;
+            used += 1u << subbits;
+
+            for (j = sub; j < used; ++j) t->fast[j] = 0;
+         }
+
+         /* incomplete code with a longer code behind a full table */
+         if (len - root > subbits) return;
+
+         for (j = rev >> root; j < (1u << subbits); j += 1u << (len - root))
+            t->fast[sub + j] = entry;
+      }
+   }
+
+   t->fast_bits = root;
+}
+
+#endif /* TINF_SMALL */
+
 /* build the fixed huffman trees */
 static void tinf_build_fixed_trees(TINF_TREE *lt, TINF_TREE *dt)
 {
@@ -120,6 +253,11 @@ static void tinf_build_fixed_trees(TINF_TREE *lt, TINF_TREE *dt)
    dt->table[5] = 32;
 
    for (i = 0; i < 32; ++i) dt->trans[i] = i;
+
+#ifndef TINF_SMALL
+   tinf_build_fast(lt);
+   tinf_build_fast(dt);
+#endif
 }
 
 /* given an array of code lengths, build a tree */
@@ -148,74 +286,124 @@ static void tinf_build_tree(TINF_TREE *t, const unsigned char *lengths, unsigned
    {
       if (lengths[i]) t->trans[offs[lengths[i]]++] = i;
    }
+
+#ifndef TINF_SMALL
+   tinf_build_fast(t);
+#endif
 }
 
 /* ---------------------- *
  * -- decode functions -- *
  * ---------------------- */
 
-/* get one bit from source stream */
-static int tinf_getbit(TINF_DATA *d)
+/* fill the bit buffer with at least TINF_BITBUF_BITS - 8 bits */
+static void tinf_refill(TINF_DATA *d)
 {
-   unsigned int bit;
+   if (d->source + sizeof(TINF_BITBUF) <= d->source_end)
+   {
+      /* load a whole word and keep as many whole bytes as fit, the
+       * bits above bitcount are the same bytes the next refill loads
+       * again, so they may stay in the tag */
+      d->tag |= *(const TINF_UNALIGNED_BITBUF *)d->source << d->bitcount;
+      d->source += (TINF_BITBUF_BITS - 1 - d->bitcount) / 8;
+      d->bitcount |= TINF_BITBUF_BITS - 8;
+      return;
+   }
 
-   /* check if tag is empty */
-   if (!d->bitcount--)
+   /* close to the end of the source, never read beyond it and shift
+    * in zeros instead, tinf_uncompress() detects the overrun */
+   while (d->bitcount <= TINF_BITBUF_BITS - 8)
    {
-      /* load next tag */
-      d->tag = *d->source++;
-      d->bitcount = 7;
+      if (d->source < d->source_end)
+         d->tag |= (TINF_BITBUF)*d->source << d->bitcount;
+
+      d->source++;
+      d->bitcount += 8;
    }
+}
 
-   /* shift bit out of tag */
-   bit = d->tag & 0x01;
-   d->tag >>= 1;
+/* look at the next 15 bits without consuming them */
+static TINF_BITBUF tinf_peek_bits(TINF_DATA *d)
+{
+   if (d->bitcount < 15) tinf_refill(d);
 
-   return bit;
+   return d->tag;
 }
 
-/* read a num bit value from a stream and add base */
+/* consume num bits that have been looked at */
+static void tinf_drop_bits(TINF_DATA *d, unsigned int num)
+{
+   d->tag >>= num;
+   d->bitcount -= num;
+}
+
+/* read a num bit value (at most 15 bits) from a stream and add base */
 static unsigned int tinf_read_bits(TINF_DATA *d, int num, int base)
 {
-   unsigned int val = 0;
+   unsigned int val;
 
-   /* read num bits */
-   if (num)
-   {
-      unsigned int limit = 1 << (num);
-      unsigned int mask;
+   if (d->bitcount < (unsigned int)num) tinf_refill(d);
 
-      for (mask = 1; mask < limit; mask *= 2)
-         if (tinf_getbit(d)) val += mask;
-   }
+   val = d->tag & ((1u << num) - 1);
+   tinf_drop_bits(d, num);
 
    return val + base;
 }
 
-/* given a data stream and a tree, decode a symbol */
-static int tinf_decode_symbol(TINF_DATA *d, TINF_TREE *t)
+/* given a data stream and a tree, decode a symbol bit by bit */
+static int tinf_decode_symbol_slow(TINF_DATA *d, TINF_TREE *t)
 {
    int sum = 0, cur = 0, len = 0;
 
    /* get more bits while code value is above sum */
    do {
 
-      cur = 2*cur + tinf_getbit(d);
+      cur = 2*cur + tinf_read_bits(d, 1, 0);
 
       ++len;
 
       sum += t->table[len];
       cur -= t->table[len];
 
-   } while (cur >= 0);
+   } while (cur >= 0 && len < 15);
+
+   if (cur >= 0) return -1;
 
    return t->trans[sum + cur];
 }
 
+/* given a data stream and a tree, decode a symbol, returns -1 for
+ * invalid codes */
+static int tinf_decode_symbol(TINF_DATA *d, TINF_TREE *t)
+{
+#ifndef TINF_SMALL
+   if (t->fast_bits)
+   {
+      TINF_BITBUF bits = tinf_peek_bits(d);
+      unsigned int entry = t->fast[bits & ((1u << t->fast_bits) - 1)];
+
+      /* long code, resolve the remaining bits in the second level */
+      if (entry & TINF_FAST_LINK)
+      {
+         bits >>= t->fast_bits;
+         entry = t->fast[((entry >> 4) & 0x7ff) + (bits & ((1u << (entry & 0xf)) - 1))];
+      }
+
+      if (!(entry & 0xf)) return -1;
+
+      tinf_drop_bits(d, entry & 0xf);
+
+      return entry >> 4;
+   }
+#endif
+
+   return tinf_decode_symbol_slow(d, t);
+}
+
 /* given a data stream, decode dynamic trees from it */
-static void tinf_decode_trees(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
+static int tinf_decode_trees(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
 {
-   TINF_TREE code_tree;
+   TINF_TREE *code_tree = &d->ctree;
    unsigned char lengths[288+32];
    unsigned int hlit, hdist, hclen;
    unsigned int i, num, length;
@@ -241,12 +429,12 @@ static void tinf_decode_trees(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
    }
 
    /* build code length tree */
-   tinf_build_tree(&code_tree, lengths, 19);
+   tinf_build_tree(code_tree, lengths, 19);
 
    /* decode code lengths for the dynamic trees */
    for (num = 0; num < hlit + hdist; )
    {
-      int sym = tinf_decode_symbol(d, &code_tree);
+      int sym = tinf_decode_symbol(d, code_tree);
 
       switch (sym)
       {
@@ -274,6 +462,8 @@ static void tinf_decode_trees(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
             lengths[num++] = 0;
          }
          break;
+      case -1:
+         return TINF_DATA_ERROR;
       default:
          /* values 0-15 represent the actual code lengths */
          lengths[num++] = sym;
@@ -284,12 +474,88 @@ static void tinf_decode_trees(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
    /* build dynamic trees */
    tinf_build_tree(lt, lengths, hlit);
    tinf_build_tree(dt, lengths + hlit, hdist);
+
+   return TINF_OK;
 }
 
 /* ----------------------------- *
  * -- block inflate functions -- *
  * ----------------------------- */
 
+/* add the output since the last call to the checksum */
+static void tinf_sum_flush(TINF_DATA *d)
+{
+   unsigned int length = d->dest - d->sum_dest;
+
+   switch (d->sum)
+   {
+   case TINF_SUM_CRC32:
+      d->checksum = tinf_crc32_update(d->checksum, d->sum_dest, length);
+      break;
+   case TINF_SUM_ADLER32:
+      d->checksum = tinf_adler32_update(d->checksum, d->sum_dest, length);
+      break;
+   }
+
+   d->sum_dest = d->dest;
+}
+
+/* copy a match of length bytes from offs bytes back, the ranges may
+ * overlap */
+static void tinf_copy_match(unsigned char *dst, unsigned int offs, unsigned int length)
+{
+   const unsigned int word = sizeof(TINF_BITBUF);
+   const unsigned char *src = dst - offs;
+   unsigned int i;
+
+   if (offs == 1)
+   {
+      /* run of a single byte, store it replicated into whole words */
+      TINF_BITBUF pattern = (TINF_BITBUF)-1 / 0xff * *src;
+
+      for (; length >= word; length -= word, dst += word)
+         *(TINF_UNALIGNED_BITBUF *)dst = pattern;
+   } else {
+      /* short distance, the output repeats with a period of offs, so
+       * copying whole periods doubles the distance until it is large
+       * enough for word copies */
+      for (; offs < word && length > offs; offs *= 2)
+      {
+         for (i = 0; i < offs; ++i) dst[i] = src[i];
+
+         dst += offs;
+         length -= offs;
+      }
+
+      src = dst - offs;
+
+      if (offs >= 4 * word)
+      {
+         for (; length >= 4 * word; length -= 4 * word, dst += 4 * word, src += 4 * word)
+         {
+            TINF_BITBUF w0 = ((const TINF_UNALIGNED_BITBUF *)src)[0];
+            TINF_BITBUF w1 = ((const TINF_UNALIGNED_BITBUF *)src)[1];
+            TINF_BITBUF w2 = ((const TINF_UNALIGNED_BITBUF *)src)[2];
+            TINF_BITBUF w3 = ((const TINF_UNALIGNED_BITBUF *)src)[3];
+
+            ((TINF_UNALIGNED_BITBUF *)dst)[0] = w0;
+            ((TINF_UNALIGNED_BITBUF *)dst)[1] = w1;
+            ((TINF_UNALIGNED_BITBUF *)dst)[2] = w2;
+            ((TINF_UNALIGNED_BITBUF *)dst)[3] = w3;
+         }
+      }
+
+      if (offs >= word)
+      {
+         for (; length >= word; length -= word, dst += word, src += word)
+            *(TINF_UNALIGNED_BITBUF *)dst = *(const TINF_UNALIGNED_BITBUF *)src;
+      }
+   }
+
+   /* copy the tail byte by byte */
+   for (src = dst - offs, i = 0; i < length; ++i) dst[i] = src[i];
+}
+
 /* given a stream and two trees, inflate a block of data */
 static int tinf_inflate_block_data(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
 {
@@ -300,6 +566,11 @@ static int tinf_inflate_block_data(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
    {
       int sym = tinf_decode_symbol(d, lt);
 
+      if (sym < 0) return TINF_DATA_ERROR;
+
+      /* stop decoding the zeros behind a truncated source */
+      if (d->source > d->source_end + sizeof(TINF_BITBUF)) return TINF_DATA_ERROR;
+
       /* check for end of block */
       if (sym == 256)
       {
@@ -314,7 +585,6 @@ static int tinf_inflate_block_data(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
       } else {
 
          int length, dist, offs;
-         int i;
 
          sym -= 257;
 
@@ -323,16 +593,17 @@ static int tinf_inflate_block_data(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
 
          dist = tinf_decode_symbol(d, dt);
 
+         if (dist < 0) return TINF_DATA_ERROR;
+
          /* possibly get more bits from distance code */
          offs = tinf_read_bits(d, dist_bits[dist], dist_base[dist]);
 
          /* copy match */
-         for (i = 0; i < length; ++i)
-         {
-            d->dest[i] = d->dest[i - offs];
-         }
+         tinf_copy_match(d->dest, offs, length);
 
          d->dest += length;
+
+         if (d->sum && d->dest - d->sum_dest >= TINF_SUM_WINDOW) tinf_sum_flush(d);
       }
    }
 }
@@ -341,7 +612,11 @@ static int tinf_inflate_block_data(TINF_DATA *d, TINF_TREE *lt, TINF_TREE *dt)
 static int tinf_inflate_uncompressed_block(TINF_DATA *d)
 {
    unsigned int length, invlength;
-   unsigned int i;
+
+   /* give back whole bytes that have been read ahead */
+   d->source -= d->bitcount / 8;
+
+   if (d->source_end - d->source < 4) return TINF_DATA_ERROR;
 
    /* get length */
    length = d->source[1];
@@ -356,10 +631,17 @@ static int tinf_inflate_uncompressed_block(TINF_DATA *d)
 
    d->source += 4;
 
-   /* copy block */
-   for (i = length; i; --i) *d->dest++ = *d->source++;
+   if ((unsigned int)(d->source_end - d->source) < length) return TINF_DATA_ERROR;
+
+   /* copy block, the compiler turns this into rep movs or a call to
+    * memcpy */
+   __builtin_memcpy(d->dest, d->source, length);
+
+   d->dest += length;
+   d->source += length;
 
    /* make sure we start next block on a byte boundary */
+   d->tag = 0;
    d->bitcount = 0;
 
    *d->destLen += length;
@@ -378,7 +660,8 @@ static int tinf_inflate_fixed_block(TINF_DATA *d)
 static int tinf_inflate_dynamic_block(TINF_DATA *d)
 {
    /* decode trees from stream */
-   tinf_decode_trees(d, &d->ltree, &d->dtree);
+   if (tinf_decode_trees(d, &d->ltree, &d->dtree) != TINF_OK)
+      return TINF_DATA_ERROR;
 
    /* decode block using decoded trees */
    return tinf_inflate_block_data(d, &d->ltree, &d->dtree);
@@ -401,22 +684,43 @@ void tinf_init()
    /* fix a special case */
    length_bits[28] = 0;
    length_base[28] = 258;
+
+   /* pick the checksum implementations now, later calls may run on
+    * several CPUs at once */
+   tinf_crc32(length_bits, 1);
+   tinf_adler32(length_bits, 1);
 }
 
 /* inflate stream from source to dest */
 int tinf_uncompress(void *dest, unsigned int *destLen,
                     const void *source, unsigned int sourceLen)
 {
+   return tinf_uncompress_sum(dest, destLen, source, sourceLen, TINF_SUM_NONE, 0);
+}
+
+/* inflate stream from source to dest and compute a checksum of the
+ * output on the way, while it is still in the cache */
+int tinf_uncompress_sum(void *dest, unsigned int *destLen,
+                        const void *source, unsigned int sourceLen,
+                        int sum, unsigned int *checksum)
+{
+   /* on the stack, so that several CPUs can inflate at once */
    TINF_DATA d;
    int bfinal;
 
    /* initialise data */
    d.source = (const unsigned char *)source;
+   d.source_end = d.source + sourceLen;
+   d.tag = 0;
    d.bitcount = 0;
 
    d.dest = (unsigned char *)dest;
    d.destLen = destLen;
 
+   d.sum = sum;
+   d.checksum = (sum == TINF_SUM_ADLER32) ? 1 : 0;
+   d.sum_dest = d.dest;
+
    *destLen = 0;
 
    do {
@@ -425,7 +729,7 @@ int tinf_uncompress(void *dest, unsigned int *destLen,
       int res;
 
       /* read final block flag */
-      bfinal = tinf_getbit(&d);
+      bfinal = tinf_read_bits(&d, 1, 0);
 
       /* read block type (2 bits) */
       btype = tinf_read_bits(&d, 2, 0);
@@ -451,7 +755,489 @@ int tinf_uncompress(void *dest, unsigned int *destLen,
 
       if (res != TINF_OK) return TINF_DATA_ERROR;
 
+      /* check that no bits beyond the source have been used */
+      if (d.source - d.bitcount / 8 > d.source_end) return TINF_DATA_ERROR;
+
+      if (d.sum) tinf_sum_flush(&d);
+
    } while (!bfinal);
 
+   if (checksum) *checksum = d.checksum;
+
    return TINF_OK;
 }
+
+/* ------------------------- *
+ * -- streaming functions -- *
+ * ------------------------- */
+
+#define TINF_WSIZE 32768
+
+/* where tinf_stream_inflate() resumes */
+enum {
+   TINF_ST_HEADER,       /* block header */
+   TINF_ST_STORED_LEN,   /* stored block length and its complement */
+   TINF_ST_STORED_COPY,  /* stored block data */
+   TINF_ST_TABLE,        /* dynamic tree sizes */
+   TINF_ST_LENLENS,      /* code lengths for the code length tree */
+   TINF_ST_CODELENS,     /* code lengths for the dynamic trees */
+   TINF_ST_LEN,          /* literal or length code */
+   TINF_ST_DIST,         /* distance code */
+   TINF_ST_DISTEXT,      /* distance extra bits */
+   TINF_ST_MATCH,        /* copy of a match */
+   TINF_ST_DONE,         /* final block done */
+   TINF_ST_ERROR,
+};
+
+struct tinf_stream_state {
+   int mode;
+   int final;
+   int sum;
+
+   /* unlike TINF_DATA, the tag never holds bits beyond bitcount */
+   TINF_BITBUF tag;
+   unsigned int bitcount;
+
+   unsigned int length;     /* match or stored block bytes left */
+   unsigned int dist;       /* match distance */
+   unsigned int dsym;       /* distance symbol before its extra bits */
+
+   unsigned int hlit, hdist, hclen, num;
+   unsigned char lengths[288+32];
+
+   const TINF_TREE *lt, *dt;
+   TINF_TREE ltree, dtree, ctree;
+
+   /* the last TINF_WSIZE bytes of output for matches that reach back
+    * into earlier calls */
+   unsigned int whave;      /* valid bytes in window */
+   unsigned int wnext;      /* next write position */
+   unsigned char window[TINF_WSIZE];
+};
+
+/* make sure num bits (at most 24, or 32 when byte aligned) are in the tag, false if the input
+ * ran out first */
+static int tinf_stream_need(TINF_STREAM *s, struct tinf_stream_state *st, unsigned int num)
+{
+   while (st->bitcount < num)
+   {
+      if (!s->avail_in) return 0;
+
+      st->tag |= (TINF_BITBUF)*s->next_in++ << st->bitcount;
+      st->bitcount += 8;
+      s->avail_in--;
+   }
+
+   return 1;
+}
+
+/* consume num bits from the tag and add base */
+static unsigned int tinf_stream_bits(struct tinf_stream_state *st, unsigned int num, unsigned int base)
+{
+   unsigned int val = st->tag & ((1u << num) - 1);
+
+   st->tag >>= num;
+   st->bitcount -= num;
+
+   return val + base;
+}
+
+/* decode a symbol from the tag without consuming it, returns -2 if
+ * more bits are needed and -1 for invalid codes */
+static int tinf_stream_symbol(const struct tinf_stream_state *st, const TINF_TREE *t,
+                              unsigned int *len)
+{
+   TINF_BITBUF bits = st->tag;
+   int sum = 0, cur = 0;
+   unsigned int l;
+
+#ifndef TINF_SMALL
+   if (t->fast_bits)
+   {
+      unsigned int entry = t->fast[bits & ((1u << t->fast_bits) - 1)];
+
+      if (entry & TINF_FAST_LINK)
+         entry = t->fast[((entry >> 4) & 0x7ff) +
+                         ((bits >> t->fast_bits) & ((1u << (entry & 0xf)) - 1))];
+
+      /* missing bits are zero in the tag, so an entry is only final
+       * if all of its bits are there */
+      if (!(entry & 0xf)) return st->bitcount < 15 ? -2 : -1;
+      if ((entry & 0xf) > st->bitcount) return -2;
+
+      *len = entry & 0xf;
+      return entry >> 4;
+   }
+#endif
+
+   for (l = 1; l < 16; ++l)
+   {
+      if (l > st->bitcount) return -2;
+
+      cur = 2*cur + ((bits >> (l - 1)) & 1);
+      sum += t->table[l];
+      cur -= t->table[l];
+
+      if (cur < 0)
+      {
+         *len = l;
+         return t->trans[sum + cur];
+      }
+   }
+
+   return -1;
+}
+
+/* decode a symbol, pulling in input as needed, returns -2 if the input
+ * ran out and -1 for invalid codes */
+static int tinf_stream_decode(TINF_STREAM *s, struct tinf_stream_state *st,
+                              const TINF_TREE *t, unsigned int *len)
+{
+   int sym;
+
+   while ((sym = tinf_stream_symbol(st, t, len)) == -2)
+      if (!tinf_stream_need(s, st, st->bitcount + 8)) return -2;
+
+   return sym;
+}
+
+/* remember the last TINF_WSIZE bytes of output ending at end */
+static void tinf_stream_window(struct tinf_stream_state *st, const unsigned char *end,
+                               unsigned int copy)
+{
+   unsigned int dist;
+
+   if (copy >= TINF_WSIZE)
+   {
+      __builtin_memcpy(st->window, end - TINF_WSIZE, TINF_WSIZE);
+      st->wnext = 0;
+      st->whave = TINF_WSIZE;
+      return;
+   }
+
+   dist = TINF_WSIZE - st->wnext;
+   if (dist > copy) dist = copy;
+
+   __builtin_memcpy(st->window + st->wnext, end - copy, dist);
+   copy -= dist;
+
+   if (copy)
+   {
+      __builtin_memcpy(st->window, end - copy, copy);
+      st->wnext = copy;
+      st->whave = TINF_WSIZE;
+   } else {
+      st->wnext += dist;
+      if (st->wnext == TINF_WSIZE) st->wnext = 0;
+      if (st->whave < TINF_WSIZE) st->whave += dist;
+   }
+}
+
+unsigned int TINFCC tinf_stream_size(void)
+{
+   return sizeof(struct tinf_stream_state);
+}
+
+/* prepare s for inflating a raw deflate stream, state must point to
+ * tinf_stream_size() bytes */
+int TINFCC tinf_stream_init(TINF_STREAM *s, void *state, int sum)
+{
+   struct tinf_stream_state *st = (struct tinf_stream_state *)state;
+
+   st->mode = TINF_ST_HEADER;
+   st->final = 0;
+   st->sum = sum;
+   st->tag = 0;
+   st->bitcount = 0;
+   st->whave = 0;
+   st->wnext = 0;
+
+   s->total_out = 0;
+   s->checksum = (sum == TINF_SUM_ADLER32) ? 1 : 0;
+   s->state = st;
+
+   return TINF_OK;
+}
+
+/* inflate as much as possible from next_in to next_out, returns
+ * TINF_OK when it needs more input or output space, TINF_DONE after
+ * the final block and TINF_DATA_ERROR for corrupt data. After
+ * TINF_DONE, next_in points behind the deflate data. */
+int TINFCC tinf_stream_inflate(TINF_STREAM *s)
+{
+   struct tinf_stream_state *st = (struct tinf_stream_state *)s->state;
+   unsigned char *out_start = s->next_out;
+   unsigned int len, produced;
+   int sym, res = TINF_OK;
+
+   for (;;)
+   {
+      switch (st->mode)
+      {
+      case TINF_ST_HEADER:
+         if (st->final)
+         {
+            /* give back the unused bits of the last byte */
+            tinf_stream_bits(st, st->bitcount & 7, 0);
+            st->mode = TINF_ST_DONE;
+            break;
+         }
+
+         if (!tinf_stream_need(s, st, 3)) goto leave;
+
+         st->final = tinf_stream_bits(st, 1, 0);
+
+         switch (tinf_stream_bits(st, 2, 0))
+         {
+         case 0:
+            tinf_stream_bits(st, st->bitcount & 7, 0);
+            st->mode = TINF_ST_STORED_LEN;
+            break;
+         case 1:
+            st->lt = &sltree;
+            st->dt = &sdtree;
+            st->mode = TINF_ST_LEN;
+            break;
+         case 2:
+            st->mode = TINF_ST_TABLE;
+            break;
+         default:
+            goto error;
+         }
+         break;
+
+      case TINF_ST_STORED_LEN:
+         /* the tag is byte aligned here, so it can hold both halves */
+         if (!tinf_stream_need(s, st, 32)) goto leave;
+
+         st->length = tinf_stream_bits(st, 16, 0);
+
+         if (st->length != (~tinf_stream_bits(st, 16, 0) & 0x0000ffff)) goto error;
+
+         st->mode = TINF_ST_STORED_COPY;
+         break;
+
+      case TINF_ST_STORED_COPY:
+         /* bytes that are still in the tag come first */
+         for (; st->length && st->bitcount && s->avail_out; --st->length, --s->avail_out)
+            *s->next_out++ = tinf_stream_bits(st, 8, 0);
+
+         len = st->length;
+         if (len > s->avail_in) len = s->avail_in;
+         if (len > s->avail_out) len = s->avail_out;
+
+         __builtin_memcpy(s->next_out, s->next_in, len);
+
+         s->next_out += len;
+         s->avail_out -= len;
+         s->next_in += len;
+         s->avail_in -= len;
+         st->length -= len;
+
+         if (st->length) goto leave;
+
+         st->mode = TINF_ST_HEADER;
+         break;
+
+      case TINF_ST_TABLE:
+         if (!tinf_stream_need(s, st, 14)) goto leave;
+
+         st->hlit = tinf_stream_bits(st, 5, 257);
+         st->hdist = tinf_stream_bits(st, 5, 1);
+         st->hclen = tinf_stream_bits(st, 4, 4);
+
+         if (st->hlit > 286 || st->hdist > 30) goto error;
+
+         for (st->num = 0; st->num < 19; ++st->num) st->lengths[st->num] = 0;
+
+         st->num = 0;
+         st->mode = TINF_ST_LENLENS;
+         break;
+
+      case TINF_ST_LENLENS:
+         for (; st->num < st->hclen; ++st->num)
+         {
+            if (!tinf_stream_need(s, st, 3)) goto leave;
+
+            st->lengths[clcidx[st->num]] = tinf_stream_bits(st, 3, 0);
+         }
+
+         tinf_build_tree(&st->ctree, st->lengths, 19);
+
+         st->num = 0;
+         st->mode = TINF_ST_CODELENS;
+         break;
+
+      case TINF_ST_CODELENS:
+         while (st->num < st->hlit + st->hdist)
+         {
+            unsigned int extra = 0, base = 0;
+            unsigned char fill = 0;
+
+            sym = tinf_stream_decode(s, st, &st->ctree, &len);
+
+            if (sym == -2) goto leave;
+            if (sym < 0) goto error;
+
+            if (sym < 16)
+            {
+               tinf_stream_bits(st, len, 0);
+               st->lengths[st->num++] = sym;
+               continue;
+            }
+
+            switch (sym)
+            {
+            case 16:
+               /* copy previous code length 3-6 times (read 2 bits) */
+               if (!st->num) goto error;
+               fill = st->lengths[st->num - 1];
+               extra = 2; base = 3;
+               break;
+            case 17:
+               /* repeat code length 0 for 3-10 times (read 3 bits) */
+               extra = 3; base = 3;
+               break;
+            default:
+               /* repeat code length 0 for 11-138 times (read 7 bits) */
+               extra = 7; base = 11;
+               break;
+            }
+
+            /* consume the symbol only together with its extra bits */
+            if (!tinf_stream_need(s, st, len + extra)) goto leave;
+
+            tinf_stream_bits(st, len, 0);
+
+            for (base = tinf_stream_bits(st, extra, base); base; --base)
+            {
+               if (st->num >= st->hlit + st->hdist) goto error;
+               st->lengths[st->num++] = fill;
+            }
+         }
+
+         tinf_build_tree(&st->ltree, st->lengths, st->hlit);
+         tinf_build_tree(&st->dtree, st->lengths + st->hlit, st->hdist);
+
+         st->lt = &st->ltree;
+         st->dt = &st->dtree;
+         st->mode = TINF_ST_LEN;
+         break;
+
+      case TINF_ST_LEN:
+         sym = tinf_stream_decode(s, st, st->lt, &len);
+
+         if (sym == -2) goto leave;
+         if (sym < 0 || sym > 285) goto error;
+
+         if (sym < 256)
+         {
+            if (!s->avail_out) goto leave;
+
+            tinf_stream_bits(st, len, 0);
+            *s->next_out++ = sym;
+            s->avail_out--;
+            break;
+         }
+
+         if (sym == 256)
+         {
+            tinf_stream_bits(st, len, 0);
+            st->mode = TINF_ST_HEADER;
+            break;
+         }
+
+         sym -= 257;
+
+         /* consume the symbol only together with its extra bits */
+         if (!tinf_stream_need(s, st, len + length_bits[sym])) goto leave;
+
+         tinf_stream_bits(st, len, 0);
+         st->length = tinf_stream_bits(st, length_bits[sym], length_base[sym]);
+         st->mode = TINF_ST_DIST;
+         break;
+
+      case TINF_ST_DIST:
+         sym = tinf_stream_decode(s, st, st->dt, &len);
+
+         if (sym == -2) goto leave;
+         if (sym < 0 || sym > 29) goto error;
+
+         tinf_stream_bits(st, len, 0);
+         st->dsym = sym;
+         st->mode = TINF_ST_DISTEXT;
+         break;
+
+      case TINF_ST_DISTEXT:
+         if (!tinf_stream_need(s, st, dist_bits[st->dsym])) goto leave;
+
+         st->dist = tinf_stream_bits(st, dist_bits[st->dsym], dist_base[st->dsym]);
+
+         if (st->dist > (unsigned int)(s->next_out - out_start) + st->whave) goto error;
+
+         st->mode = TINF_ST_MATCH;
+         break;
+
+      case TINF_ST_MATCH:
+         while (st->length && s->avail_out)
+         {
+            unsigned int have = s->next_out - out_start;
+
+            len = st->length < s->avail_out ? st->length : s->avail_out;
+
+            if (st->dist > have)
+            {
+               /* the match starts in output of an earlier call */
+               unsigned int back = st->dist - have;
+               unsigned int from = (st->wnext + TINF_WSIZE - back) & (TINF_WSIZE - 1);
+
+               if (len > back) len = back;
+               if (len > TINF_WSIZE - from) len = TINF_WSIZE - from;
+
+               __builtin_memcpy(s->next_out, st->window + from, len);
+            } else {
+               tinf_copy_match(s->next_out, st->dist, len);
+            }
+
+            s->next_out += len;
+            s->avail_out -= len;
+            st->length -= len;
+         }
+
+         if (st->length) goto leave;
+
+         st->mode = TINF_ST_LEN;
+         break;
+
+      case TINF_ST_DONE:
+         res = TINF_DONE;
+         goto leave;
+
+      default:
+      error:
+         st->mode = TINF_ST_ERROR;
+         res = TINF_DATA_ERROR;
+         goto leave;
+      }
+   }
+
+ leave:
+   produced = s->next_out - out_start;
+
+   /* the output of this call is still in the cache */
+   switch (st->sum)
+   {
+   case TINF_SUM_CRC32:
+      s->checksum = tinf_crc32_update(s->checksum, out_start, produced);
+      break;
+   case TINF_SUM_ADLER32:
+      s->checksum = tinf_adler32_update(s->checksum, out_start, produced);
+      break;
+   }
+
+   if (produced) tinf_stream_window(st, s->next_out, produced);
+
+   s->total_out += produced;
+
+   return res;
+}
@@ -38,7 +38,7 @@ int tinf_zlib_uncompress(void *dest, unsigned int *destLen,
 {
    unsigned char *src = (unsigned char *)source;
    unsigned char *dst = (unsigned char *)dest;
-   unsigned int a32;
+   unsigned int a32, sum;
    int res;
    unsigned char cmf, flg;
 
@@ -70,13 +70,14 @@ int tinf_zlib_uncompress(void *dest, unsigned int *destLen,
 
    /* -- inflate -- */
 
-   res = tinf_uncompress(dst, destLen, src + 2, sourceLen - 6);
+   res = tinf_uncompress_sum(dst, destLen, src + 2, sourceLen - 6,
+                             TINF_SUM_ADLER32, &sum);
 
    if (res != TINF_OK) return TINF_DATA_ERROR;
 
    /* -- check adler32 checksum -- */
 
-   if (a32 != tinf_adler32(dst, *destLen)) return TINF_DATA_ERROR;
+   if (a32 != sum) return TINF_DATA_ERROR;
 
    return TINF_OK;
 }
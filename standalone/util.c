@@ -20,27 +20,51 @@
 /**
  * Wait roughly a given number of milliseconds.
  *
- * We use the PIT for this.
+ * We use the TSC for this.
  */
 void
 wait(int ms)
 {
-  /* the PIT counts with 1.193 Mhz */
-  ms*=1193;
+  udelay(ms * 1000);
+}
 
-  /* initalize the PIT, let counter0 count from 256 backwards */
-  outb(0x43,0x14);
-  outb(0x40,0);
+static struct {
+  background_fn poll;
+  background_fn finish;
+  void *arg;
+} background;
 
-  unsigned char state;
-  unsigned char old = 0;
-  while (ms>0)
-    {
-      outb(0x43,0);
-      state = inb(0x40);
-      ms -= (unsigned char)(old - state);
-      old = state;
-    }
+void
+background_start(background_fn poll, background_fn finish, void *arg)
+{
+  background.poll   = poll;
+  background.finish = finish;
+  background.arg    = arg;
+}
+
+/**
+ * Give the background work a chance to progress. Call this between
+ * chunks of long running work.
+ */
+void
+background_poll(void)
+{
+  if (background.poll)
+    background.poll(background.arg);
+}
+
+/**
+ * Wait for the background work to complete. Afterwards, there is
+ * none.
+ */
+void
+background_finish(void)
+{
+  background_fn finish = background.finish;
+
+  background.poll = background.finish = NULL;
+  if (finish)
+    finish(background.arg);
 }
 
 /**
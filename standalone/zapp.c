@@ -116,6 +116,8 @@ main(uint32_t magic, struct mbi *mbi)
     return 1;
   }
 
+  pci_init(mbi);
+
   struct rsdp *rsdp = acpi_get_rsdp();
   struct acpi_table *rsdt = (struct acpi_table *)(rsdp->rsdt);
   printf("RSDT at %p.\n", rsdt);
@@ -192,28 +194,28 @@ main(uint32_t magic, struct mbi *mbi)
       uint16_t bdf =  dev.cfg_address >> 8;
       if (!pci_find_cap(dev.cfg_address, PCI_CAP_ID_EXP)) {
         /* we are not PCIe device, thus we probably sit behind a bridge - scan the root bus*/
-        for (unsigned device=0; device < 32; device++) {
-          uint8_t maxfunc = 0;
-          for (unsigned func = 0; func <= maxfunc; func++) {
-            uint32_t addr = 0x80000000 | device<<11 | func<<8;
-	      
-            if (!maxfunc && pci_read_uint8(addr+14) & 0x80)
-              maxfunc=7;
-
-            /* Is this a bridge and is our bus encoded from it? */
-            if ((((PCI_CLASS_BRIDGE_DEV << 8) | PCI_SUBCLASS_PCI_BRIDGE) == (pci_read_uint32(addr+0x8) >> 16))
-                && (pci_read_uint8(addr + 25) <= (bdf >> 8) && pci_read_uint8(addr + 26) >= (bdf >> 8))) {
-	      /* Check wether we have a PCIe->PCI-X bridge and need to
-		 add an additional RMRR for claimed transactions. */
-	      uint8_t capofs = pci_find_cap(addr, PCI_CAP_ID_EXP);
-	      if (capofs && ((pci_read_uint8(addr + capofs + 2) >> 4) == PCI_EXP_TYPE_PCI_BRIDGE)) {
-		printf("Add additional RMRR for secondary bus of PCIe->PCIX/PCI bridge.\n");
-		add_rmrr_entry(newdmar, additions[i].base, additions[i].size, pci_read_uint8(addr + 25) << 8);
-	      } else {
-		printf("Add RMRR for legacy PCI bridge instead.\n");
-		bdf = (device << 3) | func;
-	      }
-	    }
+        const struct pci_table *devices = pci_devices();
+
+        for (unsigned j = 0; j < devices->count; j++) {
+          const struct pci_entry *bridge = &devices->dev[j];
+          uint32_t addr = bridge->cfg_address;
+
+          if ((addr >> 16) & 0xFF)
+            break;
+
+          /* Is this a bridge and is our bus encoded from it? */
+          if ((((PCI_CLASS_BRIDGE_DEV << 8) | PCI_SUBCLASS_PCI_BRIDGE) == (bridge->class_rev >> 16))
+              && (bridge->secondary_bus <= (bdf >> 8) && bridge->subordinate_bus >= (bdf >> 8))) {
+            /* Check wether we have a PCIe->PCI-X bridge and need to
+               add an additional RMRR for claimed transactions. */
+            uint8_t capofs = pci_find_cap(addr, PCI_CAP_ID_EXP);
+            if (capofs && ((pci_read_uint8(addr + capofs + 2) >> 4) == PCI_EXP_TYPE_PCI_BRIDGE)) {
+              printf("Add additional RMRR for secondary bus of PCIe->PCIX/PCI bridge.\n");
+              add_rmrr_entry(newdmar, additions[i].base, additions[i].size, bridge->secondary_bus << 8);
+            } else {
+              printf("Add RMRR for legacy PCI bridge instead.\n");
+              bdf = (addr >> 8) & 0xFF;
+            }
           }
         }
       }
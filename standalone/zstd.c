@@ -0,0 +1,1033 @@
+/* -*- Mode: C -*- */
+/*
+ * Zstandard frame decoder after RFC 8878.
+ *
+ * Frames are decoded into one contiguous buffer, which doubles as the
+ * window. Concatenated and skippable frames are supported,
+ * dictionaries are not. Size queries need the frame content size in
+ * the header, which zstd writes unless it compresses a pipe.
+ *
+ * Copyright (C) 2026, agent <agent@local>
+ *
+ * This file is part of Morbo.
+ *
+ * Morbo is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Morbo is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <stddef.h>
+#include <codec.h>
+#include <tinf.h>
+
+enum {
+  ZSTD_MAGIC         = 0xFD2FB528,
+  ZSTD_SKIP_MAGIC    = 0x184D2A50,
+  ZSTD_SKIP_MASK     = 0xFFFFFFF0,
+
+  ZSTD_BLOCK_MAX     = 128 << 10,
+
+  ZSTD_BLOCK_RAW     = 0,
+  ZSTD_BLOCK_RLE     = 1,
+  ZSTD_BLOCK_COMP    = 2,
+
+  ZSTD_LIT_RAW       = 0,
+  ZSTD_LIT_RLE       = 1,
+  ZSTD_LIT_COMP      = 2,
+  ZSTD_LIT_TREELESS  = 3,
+
+  ZSTD_MODE_PREDEF   = 0,
+  ZSTD_MODE_RLE      = 1,
+  ZSTD_MODE_FSE      = 2,
+  ZSTD_MODE_REPEAT   = 3,
+
+  HUF_MAX_BITS       = 11,
+  HUF_MAX_SYMBOLS    = 256,
+
+  FSE_MAX_LOG        = 9,
+  FSE_MAX_SYMBOLS    = 256,
+
+  LL_MAX_LOG         = 9,
+  ML_MAX_LOG         = 9,
+  OF_MAX_LOG         = 8,
+  LL_MAX_CODE        = 35,
+  ML_MAX_CODE        = 52,
+  OF_MAX_CODE        = 31,
+};
+
+struct fse_entry {
+  uint8_t  symbol;
+  uint8_t  bits;
+  uint16_t base;
+};
+
+struct fse_table {
+  unsigned log;
+  struct fse_entry e[1 << FSE_MAX_LOG];
+};
+
+struct huf_entry {
+  uint8_t symbol;
+  uint8_t bits;
+};
+
+struct zstd_state {
+  uint8_t *base;                /* Start of the frame's output */
+  uint8_t *op;
+  uint8_t *oend;
+
+  uint32_t rep[3];
+
+  unsigned huf_bits;            /* 0 if there is no Huffman table yet */
+  struct huf_entry huf[1 << HUF_MAX_BITS];
+
+  struct fse_table ll, of, ml;
+  bool ll_ok, of_ok, ml_ok;
+};
+
+static const uint32_t ll_base[LL_MAX_CODE + 1] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+  16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+  8192, 16384, 32768, 65536,
+};
+
+static const uint8_t ll_bits[LL_MAX_CODE + 1] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+  13, 14, 15, 16,
+};
+
+static const uint32_t ml_base[ML_MAX_CODE + 1] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+  19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+  35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+  4099, 8195, 16387, 32771, 65539,
+};
+
+static const uint8_t ml_bits[ML_MAX_CODE + 1] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+  12, 13, 14, 15, 16,
+};
+
+/* Predefined distributions, -1 stands for "less than 1". */
+static const int16_t ll_default[LL_MAX_CODE + 1] = {
+  4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+  -1, -1, -1, -1,
+};
+
+static const int16_t ml_default[ML_MAX_CODE + 1] = {
+  1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+  -1, -1, -1, -1, -1,
+};
+
+static const int16_t of_default[29] = {
+  1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1,
+};
+
+static uint32_t
+zstd_le32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static unsigned
+highbit(uint32_t v)
+{
+  return 31 - __builtin_clz(v);
+}
+
+/* Backward bit stream. Bits are read from the end of the stream
+   towards its start, starting below the highest set bit of the last
+   byte. */
+
+struct bits_rev {
+  const uint8_t *start;
+  const uint8_t *ptr;
+  uint64_t container;
+  unsigned consumed;
+};
+
+static uint64_t
+load_le64(const uint8_t *p)
+{
+  return zstd_le32(p) | (uint64_t)zstd_le32(p + 4) << 32;
+}
+
+static bool
+bits_init(struct bits_rev *b, const uint8_t *src, size_t len)
+{
+  if ((len == 0) || (src[len - 1] == 0))
+    return false;
+
+  b->start = src;
+
+  if (len >= 8) {
+    b->ptr = src + len - 8;
+    b->container = load_le64(b->ptr);
+    b->consumed = 0;
+  } else {
+    b->ptr = src;
+    b->container = 0;
+    for (size_t i = 0; i < len; i++)
+      b->container |= (uint64_t)src[i] << (8 * i);
+    b->consumed = (8 - len) * 8;
+  }
+
+  /* Skip the padding and the marker bit. */
+  b->consumed += 8 - highbit(src[len - 1]);
+  return true;
+}
+
+static void
+bits_reload(struct bits_rev *b)
+{
+  size_t bytes = b->consumed >> 3;
+
+  /* Short streams never load beyond the start. */
+  if ((b->consumed > 64) || (b->ptr == b->start))
+    return;
+
+  if ((size_t)(b->ptr - b->start) < bytes)
+    bytes = b->ptr - b->start;
+
+  b->ptr -= bytes;
+  b->consumed -= bytes * 8;
+  b->container = load_le64(b->ptr);
+}
+
+static uint32_t
+bits_peek(const struct bits_rev *b, unsigned n)
+{
+  if (b->consumed >= 64)
+    return 0;
+  return ((b->container << b->consumed) >> 1) >> (63 - n);
+}
+
+static uint32_t
+bits_read(struct bits_rev *b, unsigned n)
+{
+  uint32_t v = bits_peek(b, n);
+  b->consumed += n;
+  return v;
+}
+
+/* True if more bits were read than the stream holds. */
+static bool
+bits_overflow(const struct bits_rev *b)
+{
+  return b->consumed > 64;
+}
+
+/* True if exactly all bits were read. */
+static bool
+bits_done(const struct bits_rev *b)
+{
+  return (b->ptr == b->start) && (b->consumed == 64);
+}
+
+/* FSE */
+
+/**
+ * Read a table description from a forward bit stream. Returns the
+ * number of bytes used or 0 on error.
+ */
+static size_t
+fse_read_counts(int16_t *norm, unsigned *max_symbol, unsigned *log,
+                unsigned max_log, const uint8_t *src, size_t len)
+{
+  size_t pos = 0;               /* In bits */
+  unsigned symbol = 0;
+  bool previous0 = false;
+
+#define PEEK(n) ({ uint32_t _v = 0;                                     \
+      for (unsigned _i = 0; _i < (n); _i++) {                           \
+        size_t _p = pos + _i;                                           \
+        if ((_p >> 3) < len)                                            \
+          _v |= ((src[_p >> 3] >> (_p & 7)) & 1U) << _i;                \
+      }                                                                 \
+      _v; })
+
+  if (len < 1)
+    return 0;
+
+  *log = PEEK(4) + 5;
+  pos += 4;
+  if (*log > max_log)
+    return 0;
+
+  int remaining = (1 << *log) + 1;
+  int threshold = 1 << *log;
+  unsigned nbits = *log + 1;
+
+  while ((remaining > 1) && (symbol <= *max_symbol)) {
+    if (previous0) {
+      unsigned repeat;
+
+      do {
+        repeat = PEEK(2);
+        pos += 2;
+        for (unsigned i = 0; i < repeat; i++) {
+          if (symbol > *max_symbol)
+            return 0;
+          norm[symbol++] = 0;
+        }
+      } while (repeat == 3);
+
+      previous0 = false;
+      continue;
+    }
+
+    int max = (2 * threshold - 1) - remaining;
+    int count;
+
+    if ((int)(PEEK(nbits - 1)) < max) {
+      count = PEEK(nbits - 1);
+      pos += nbits - 1;
+    } else {
+      count = PEEK(nbits);
+      if (count >= threshold)
+        count -= max;
+      pos += nbits;
+    }
+
+    count--;
+    remaining -= (count < 0) ? -count : count;
+    norm[symbol++] = count;
+    previous0 = (count == 0);
+
+    while (remaining < threshold) {
+      nbits--;
+      threshold >>= 1;
+    }
+  }
+
+#undef PEEK
+
+  if ((remaining != 1) || (((pos + 7) >> 3) > len))
+    return 0;
+
+  *max_symbol = symbol - 1;
+  return (pos + 7) >> 3;
+}
+
+static bool
+fse_build(struct fse_table *t, const int16_t *norm, unsigned max_symbol,
+          unsigned log)
+{
+  unsigned size = 1 << log;
+  unsigned high = size - 1;
+  uint16_t next[FSE_MAX_SYMBOLS];
+
+  t->log = log;
+
+  /* "Less than 1" symbols go to the end of the table. */
+  for (unsigned s = 0; s <= max_symbol; s++) {
+    if (norm[s] == -1) {
+      t->e[high--].symbol = s;
+      next[s] = 1;
+    } else
+      next[s] = norm[s];
+  }
+
+  unsigned step = (size >> 1) + (size >> 3) + 3;
+  unsigned pos = 0;
+
+  for (unsigned s = 0; s <= max_symbol; s++)
+    for (int i = 0; i < norm[s]; i++) {
+      t->e[pos].symbol = s;
+      do {
+        pos = (pos + step) & (size - 1);
+      } while (pos > high);
+    }
+
+  if (pos != 0)
+    return false;
+
+  for (unsigned i = 0; i < size; i++) {
+    unsigned s = t->e[i].symbol;
+    unsigned n = next[s]++;
+
+    t->e[i].bits = log - highbit(n);
+    t->e[i].base = (n << t->e[i].bits) - size;
+  }
+
+  return true;
+}
+
+static void
+fse_build_rle(struct fse_table *t, uint8_t symbol)
+{
+  t->log = 0;
+  t->e[0].symbol = symbol;
+  t->e[0].bits = 0;
+  t->e[0].base = 0;
+}
+
+static unsigned
+fse_init(const struct fse_table *t, struct bits_rev *b)
+{
+  return bits_read(b, t->log);
+}
+
+static unsigned
+fse_update(const struct fse_table *t, unsigned state, struct bits_rev *b)
+{
+  return t->e[state].base + bits_read(b, t->e[state].bits);
+}
+
+/* Huffman */
+
+/**
+ * Read the Huffman tree description. Returns the number of bytes used
+ * or 0 on error.
+ */
+static size_t
+huf_read(struct zstd_state *z, const uint8_t *src, size_t len)
+{
+  uint8_t weights[HUF_MAX_SYMBOLS];
+  unsigned count = 0;
+  size_t used;
+
+  if (len < 1)
+    return 0;
+
+  if (src[0] < 128) {
+    /* FSE compressed weights with two interleaved states. */
+    struct fse_table t;
+    int16_t norm[16];
+    unsigned max_symbol = 15, log;
+    size_t clen = src[0];
+
+    if (clen + 1 > len)
+      return 0;
+
+    size_t hlen = fse_read_counts(norm, &max_symbol, &log, 6, src + 1, clen);
+    if (!hlen || !fse_build(&t, norm, max_symbol, log))
+      return 0;
+
+    struct bits_rev b;
+    if (!bits_init(&b, src + 1 + hlen, clen - hlen))
+      return 0;
+
+    unsigned s1 = fse_init(&t, &b);
+    unsigned s2 = fse_init(&t, &b);
+
+    /* Leave room for the last symbols and the implied weight. */
+    for (;;) {
+      if (count + 3 > HUF_MAX_SYMBOLS)
+        return 0;
+      weights[count++] = t.e[s1].symbol;
+      bits_reload(&b);
+      s1 = fse_update(&t, s1, &b);
+      if (bits_overflow(&b)) {
+        weights[count++] = t.e[s2].symbol;
+        break;
+      }
+
+      if (count + 3 > HUF_MAX_SYMBOLS)
+        return 0;
+      weights[count++] = t.e[s2].symbol;
+      bits_reload(&b);
+      s2 = fse_update(&t, s2, &b);
+      if (bits_overflow(&b)) {
+        weights[count++] = t.e[s1].symbol;
+        break;
+      }
+    }
+
+    used = 1 + clen;
+  } else {
+    /* Direct 4 bit weights. */
+    count = src[0] - 127;
+    used = 1 + (count + 1) / 2;
+
+    if ((used > len) || (count >= HUF_MAX_SYMBOLS))
+      return 0;
+
+    for (unsigned i = 0; i < count; i++)
+      weights[i] = (i & 1) ? (src[1 + i / 2] & 15) : (src[1 + i / 2] >> 4);
+  }
+
+  /* The last weight is implied, it fills up to a power of two. */
+  uint32_t total = 0;
+  for (unsigned i = 0; i < count; i++) {
+    if (weights[i] > HUF_MAX_BITS)
+      return 0;
+    if (weights[i])
+      total += 1U << (weights[i] - 1);
+  }
+
+  if (total == 0)
+    return 0;
+
+  unsigned bits = highbit(total) + 1;
+  uint32_t rest = (1U << bits) - total;
+
+  if ((bits > HUF_MAX_BITS) || (rest & (rest - 1)))
+    return 0;
+
+  weights[count++] = highbit(rest) + 1;
+
+  /* Codes are assigned by increasing weight, then by symbol. */
+  uint32_t rank[HUF_MAX_BITS + 2] = { 0 };
+  for (unsigned i = 0; i < count; i++)
+    if (weights[i])
+      rank[weights[i]] += 1U << (weights[i] - 1);
+
+  uint32_t next = 0;
+  for (unsigned w = 1; w <= bits; w++) {
+    uint32_t n = rank[w];
+    rank[w] = next;
+    next += n;
+  }
+
+  for (unsigned s = 0; s < count; s++) {
+    unsigned w = weights[s];
+    if (!w)
+      continue;
+
+    for (uint32_t i = rank[w]; i < rank[w] + (1U << (w - 1)); i++) {
+      z->huf[i].symbol = s;
+      z->huf[i].bits = bits + 1 - w;
+    }
+    rank[w] += 1U << (w - 1);
+  }
+
+  z->huf_bits = bits;
+  return used;
+}
+
+static bool
+huf_stream(const struct zstd_state *z, uint8_t *out, size_t n,
+           const uint8_t *src, size_t len)
+{
+  struct bits_rev b;
+
+  if (!bits_init(&b, src, len))
+    return false;
+
+  for (size_t i = 0; i < n; i++) {
+    const struct huf_entry *e = &z->huf[bits_peek(&b, z->huf_bits)];
+
+    out[i] = e->symbol;
+    b.consumed += e->bits;
+    bits_reload(&b);
+  }
+
+  return bits_done(&b);
+}
+
+/* Literals */
+
+/**
+ * Where to decode literals to. They go to the end of the output space
+ * of the current block, so the sequences consume them before
+ * overwriting them. This keeps the decoder within one block of its
+ * output, which in-place decompression relies on.
+ */
+static uint8_t *
+zstd_lit_buffer(struct zstd_state *z, size_t regen)
+{
+  size_t room = z->oend - z->op;
+
+  if (room > ZSTD_BLOCK_MAX)
+    room = ZSTD_BLOCK_MAX;
+  return z->op + room - regen;
+}
+
+/**
+ * Decode the literals section. Literals that need decoding go to the
+ * end of the block's output space, see zstd_lit_buffer(). Returns the
+ * number of bytes used or 0 on error.
+ */
+static size_t
+zstd_literals(struct zstd_state *z, const uint8_t *src, size_t len,
+              const uint8_t **lit, size_t *lit_len)
+{
+  size_t regen, comp, hlen;
+
+  if (len < 1)
+    return 0;
+
+  unsigned type = src[0] & 3;
+  unsigned format = (src[0] >> 2) & 3;
+
+  if ((type == ZSTD_LIT_RAW) || (type == ZSTD_LIT_RLE)) {
+    hlen = (format == 1) ? 2 : (format == 3) ? 3 : 1;
+    if (hlen > len)
+      return 0;
+
+    switch (hlen) {
+    case 1:
+      regen = src[0] >> 3;
+      break;
+    case 2:
+      regen = (src[0] >> 4) + (src[1] << 4);
+      break;
+    default:
+      regen = (src[0] >> 4) + (src[1] << 4) + (src[2] << 12);
+      break;
+    }
+
+    if (regen > ZSTD_BLOCK_MAX)
+      return 0;
+
+    if (type == ZSTD_LIT_RAW) {
+      if (hlen + regen > len)
+        return 0;
+      *lit = src + hlen;
+      *lit_len = regen;
+      return hlen + regen;
+    }
+
+    if ((hlen + 1 > len) || (regen > (size_t)(z->oend - z->op)))
+      return 0;
+
+    uint8_t *buf = zstd_lit_buffer(z, regen);
+    __builtin_memset(buf, src[hlen], regen);
+    *lit = buf;
+    *lit_len = regen;
+    return hlen + 1;
+  }
+
+  /* Huffman coded literals. */
+  unsigned streams = (format == 0) ? 1 : 4;
+  uint32_t h;
+
+  switch (format) {
+  case 0: case 1:
+    if (len < 3) return 0;
+    h = src[0] | src[1] << 8 | src[2] << 16;
+    hlen = 3; regen = (h >> 4) & 0x3FF; comp = (h >> 14) & 0x3FF;
+    break;
+  case 2:
+    if (len < 4) return 0;
+    h = zstd_le32(src);
+    hlen = 4; regen = (h >> 4) & 0x3FFF; comp = h >> 18;
+    break;
+  default:
+    if (len < 5) return 0;
+    h = zstd_le32(src);
+    hlen = 5; regen = (h >> 4) & 0x3FFFF; comp = (h >> 22) + (src[4] << 10);
+    break;
+  }
+
+  if ((hlen + comp > len) || (regen > ZSTD_BLOCK_MAX) ||
+      (regen > (size_t)(z->oend - z->op)))
+    return 0;
+
+  const uint8_t *p = src + hlen;
+  size_t plen = comp;
+
+  if (type == ZSTD_LIT_COMP) {
+    size_t tlen = huf_read(z, p, plen);
+    if (!tlen)
+      return 0;
+    p += tlen;
+    plen -= tlen;
+  } else if (!z->huf_bits)
+    return 0;
+
+  uint8_t *buf = zstd_lit_buffer(z, regen);
+
+  if (streams == 1) {
+    if (!huf_stream(z, buf, regen, p, plen))
+      return 0;
+  } else {
+    if (plen < 6)
+      return 0;
+
+    size_t s[4], seg = (regen + 3) / 4;
+    s[0] = p[0] | p[1] << 8;
+    s[1] = p[2] | p[3] << 8;
+    s[2] = p[4] | p[5] << 8;
+    if (s[0] + s[1] + s[2] + 6 > plen)
+      return 0;
+    s[3] = plen - 6 - s[0] - s[1] - s[2];
+
+    if (seg * 3 > regen)
+      return 0;
+
+    p += 6;
+    for (unsigned i = 0; i < 4; i++) {
+      size_t n = (i < 3) ? seg : regen - 3 * seg;
+      if (!huf_stream(z, buf + i * seg, n, p, s[i]))
+        return 0;
+      p += s[i];
+    }
+  }
+
+  *lit = buf;
+  *lit_len = regen;
+  return hlen + comp;
+}
+
+/* Sequences */
+
+static size_t
+zstd_table(struct fse_table *t, bool *ok, unsigned mode,
+           const int16_t *def, unsigned def_max, unsigned def_log,
+           unsigned max_code, unsigned max_log,
+           const uint8_t *src, size_t len)
+{
+  int16_t norm[FSE_MAX_SYMBOLS];
+  unsigned max_symbol = max_code, log;
+  size_t used;
+
+  switch (mode) {
+  case ZSTD_MODE_PREDEF:
+    fse_build(t, def, def_max, def_log);
+    *ok = true;
+    return 0;
+  case ZSTD_MODE_RLE:
+    if ((len < 1) || (src[0] > max_code))
+      return (size_t)-1;
+    fse_build_rle(t, src[0]);
+    *ok = true;
+    return 1;
+  case ZSTD_MODE_FSE:
+    used = fse_read_counts(norm, &max_symbol, &log, max_log, src, len);
+    if (!used || !fse_build(t, norm, max_symbol, log))
+      return (size_t)-1;
+    *ok = true;
+    return used;
+  default:
+    return *ok ? 0 : (size_t)-1;
+  }
+}
+
+/* Copy forward. Overlapping matches rely on this, and so do literals
+   that are moved down to the output from the end of the buffer. */
+static void
+zstd_copy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+  if ((dst >= src + 8) || (src >= dst + 8)) {
+    for (; len >= 8; len -= 8, dst += 8, src += 8)
+      __builtin_memcpy(dst, src, 8);
+  }
+  for (; len; len--)
+    *dst++ = *src++;
+}
+
+static bool
+zstd_block(struct zstd_state *z, const uint8_t *src, size_t len)
+{
+  const uint8_t *lit;
+  size_t lit_len;
+  size_t used = zstd_literals(z, src, len, &lit, &lit_len);
+
+  if (!used)
+    return false;
+
+  src += used;
+  len -= used;
+
+  /* Number of sequences */
+  unsigned nseq;
+
+  if (len < 1)
+    return false;
+
+  if (src[0] < 128) {
+    nseq = src[0];
+    used = 1;
+  } else if (src[0] < 255) {
+    if (len < 2) return false;
+    nseq = ((src[0] - 128) << 8) + src[1];
+    used = 2;
+  } else {
+    if (len < 3) return false;
+    nseq = src[1] + (src[2] << 8) + 0x7F00;
+    used = 3;
+  }
+
+  src += used;
+  len -= used;
+
+  if (nseq == 0) {
+    if ((len != 0) || (lit_len > (size_t)(z->oend - z->op)))
+      return false;
+    zstd_copy(z->op, lit, lit_len);
+    z->op += lit_len;
+    return true;
+  }
+
+  if (len < 1)
+    return false;
+
+  unsigned modes = src[0];
+  src++;
+  len--;
+
+  if (modes & 3)
+    return false;
+
+  used = zstd_table(&z->ll, &z->ll_ok, modes >> 6, ll_default, LL_MAX_CODE, 6,
+                    LL_MAX_CODE, LL_MAX_LOG, src, len);
+  if (used == (size_t)-1) return false;
+  src += used; len -= used;
+
+  used = zstd_table(&z->of, &z->of_ok, (modes >> 4) & 3, of_default, 28, 5,
+                    OF_MAX_CODE, OF_MAX_LOG, src, len);
+  if (used == (size_t)-1) return false;
+  src += used; len -= used;
+
+  used = zstd_table(&z->ml, &z->ml_ok, (modes >> 2) & 3, ml_default, ML_MAX_CODE, 6,
+                    ML_MAX_CODE, ML_MAX_LOG, src, len);
+  if (used == (size_t)-1) return false;
+  src += used; len -= used;
+
+  struct bits_rev b;
+  if (!bits_init(&b, src, len))
+    return false;
+
+  unsigned ll_state = fse_init(&z->ll, &b);
+  unsigned of_state = fse_init(&z->of, &b);
+  bits_reload(&b);
+  unsigned ml_state = fse_init(&z->ml, &b);
+
+  const uint8_t *lit_end = lit + lit_len;
+
+  for (unsigned i = 0; i < nseq; i++) {
+    unsigned ll_code = z->ll.e[ll_state].symbol;
+    unsigned of_code = z->of.e[of_state].symbol;
+    unsigned ml_code = z->ml.e[ml_state].symbol;
+
+    if ((ll_code > LL_MAX_CODE) || (ml_code > ML_MAX_CODE) || (of_code > OF_MAX_CODE))
+      return false;
+
+    bits_reload(&b);
+    uint32_t offset = (1U << of_code) + bits_read(&b, of_code);
+    bits_reload(&b);
+    uint32_t ml = ml_base[ml_code] + bits_read(&b, ml_bits[ml_code]);
+    uint32_t ll = ll_base[ll_code] + bits_read(&b, ll_bits[ll_code]);
+
+    if (i + 1 < nseq) {
+      bits_reload(&b);
+      ll_state = fse_update(&z->ll, ll_state, &b);
+      ml_state = fse_update(&z->ml, ml_state, &b);
+      bits_reload(&b);
+      of_state = fse_update(&z->of, of_state, &b);
+    }
+
+    /* Repeat offsets */
+    if (offset > 3) {
+      offset -= 3;
+      z->rep[2] = z->rep[1];
+      z->rep[1] = z->rep[0];
+      z->rep[0] = offset;
+    } else {
+      unsigned idx = offset - 1 + (ll == 0);
+
+      if (idx == 0)
+        offset = z->rep[0];
+      else {
+        offset = (idx == 3) ? z->rep[0] - 1 : z->rep[idx];
+        if (idx != 1)
+          z->rep[2] = z->rep[1];
+        z->rep[1] = z->rep[0];
+        z->rep[0] = offset;
+      }
+    }
+
+    /* Execute the sequence. */
+    if ((ll > (size_t)(lit_end - lit)) ||
+        ((size_t)(z->oend - z->op) < (size_t)ll + ml))
+      return false;
+
+    zstd_copy(z->op, lit, ll);
+    z->op += ll;
+    lit += ll;
+
+    if ((offset == 0) || (offset > (size_t)(z->op - z->base)))
+      return false;
+
+    zstd_copy(z->op, z->op - offset, ml);
+    z->op += ml;
+  }
+
+  if (!bits_done(&b))
+    return false;
+
+  /* Trailing literals */
+  if ((size_t)(lit_end - lit) > (size_t)(z->oend - z->op))
+    return false;
+
+  zstd_copy(z->op, lit, lit_end - lit);
+  z->op += lit_end - lit;
+
+  return true;
+}
+
+/* Frames */
+
+/**
+ * Parse a frame header. Returns its length or 0 on error. The content
+ * size is ~0ULL if the header does not have it.
+ */
+static size_t
+zstd_frame_header(const uint8_t *src, size_t len, uint64_t *content, bool *checksum)
+{
+  if (len < 6)
+    return 0;
+
+  uint8_t fhd = src[4];
+  unsigned fcs_flag = fhd >> 6;
+  bool single = fhd & (1 << 5);
+  unsigned did_flag = fhd & 3;
+
+  if ((fhd & (1 << 3)) || did_flag)
+    return 0;
+
+  size_t pos = 5 + !single;
+  size_t fcs_len = (fcs_flag == 0) ? single : (1U << fcs_flag);
+
+  if (pos + fcs_len > len)
+    return 0;
+
+  *checksum = fhd & (1 << 2);
+
+  switch (fcs_len) {
+  case 0: *content = ~0ULL; break;
+  case 1: *content = src[pos]; break;
+  case 2: *content = (src[pos] | src[pos + 1] << 8) + 256; break;
+  case 4: *content = zstd_le32(src + pos); break;
+  default: *content = load_le64(src + pos); break;
+  }
+
+  return pos + fcs_len;
+}
+
+/**
+ * Decompress zstd frames. If dest is NULL, return the uncompressed
+ * length in *destLen. This needs the content size in every frame
+ * header.
+ */
+int
+zstd_uncompress(void *dest, unsigned int *destLen,
+                const void *source, unsigned int sourceLen)
+{
+  /* On the stack, so that several CPUs can decompress at once. */
+  struct zstd_state zs;
+  struct zstd_state *z = &zs;
+  const uint8_t *ip = source;
+  const uint8_t *iend = ip + sourceLen;
+  uint8_t *op = dest;
+  uint8_t *oend = dest ? op + *destLen : NULL;
+  uint64_t total = 0;
+
+  while (ip < iend) {
+    if (iend - ip < 8)
+      return TINF_DATA_ERROR;
+
+    uint32_t magic = zstd_le32(ip);
+
+    if ((magic & ZSTD_SKIP_MASK) == ZSTD_SKIP_MAGIC) {
+      uint32_t skip = zstd_le32(ip + 4);
+      if ((size_t)(iend - ip - 8) < skip)
+        return TINF_DATA_ERROR;
+      ip += 8 + skip;
+      continue;
+    }
+
+    if (magic != ZSTD_MAGIC)
+      return TINF_DATA_ERROR;
+
+    uint64_t content;
+    bool checksum;
+    size_t hlen = zstd_frame_header(ip, iend - ip, &content, &checksum);
+
+    if (!hlen)
+      return TINF_DATA_ERROR;
+    ip += hlen;
+
+    if (!dest) {
+      if (content == ~0ULL)
+        return TINF_DATA_ERROR;
+      total += content;
+    } else {
+      z->base = op;
+      z->op = op;
+      z->oend = oend;
+      z->rep[0] = 1;
+      z->rep[1] = 4;
+      z->rep[2] = 8;
+      z->huf_bits = 0;
+      z->ll_ok = z->of_ok = z->ml_ok = false;
+    }
+
+    bool last;
+    do {
+      if (iend - ip < 3)
+        return TINF_DATA_ERROR;
+
+      uint32_t bh = ip[0] | ip[1] << 8 | ip[2] << 16;
+      unsigned type = (bh >> 1) & 3;
+      size_t size = bh >> 3;
+
+      last = bh & 1;
+      ip += 3;
+
+      size_t clen = (type == ZSTD_BLOCK_RLE) ? 1 : size;
+      if ((clen > (size_t)(iend - ip)) || (size > ZSTD_BLOCK_MAX))
+        return TINF_DATA_ERROR;
+
+      if (dest) {
+        switch (type) {
+        case ZSTD_BLOCK_RAW:
+        case ZSTD_BLOCK_RLE:
+          if (size > (size_t)(z->oend - z->op))
+            return TINF_DATA_ERROR;
+          if (type == ZSTD_BLOCK_RAW)
+            __builtin_memcpy(z->op, ip, size);
+          else
+            __builtin_memset(z->op, ip[0], size);
+          z->op += size;
+          break;
+        case ZSTD_BLOCK_COMP:
+          if (!zstd_block(z, ip, size))
+            return TINF_DATA_ERROR;
+          break;
+        default:
+          return TINF_DATA_ERROR;
+        }
+      }
+
+      ip += clen;
+    } while (!last);
+
+    if (checksum) {
+      if (iend - ip < 4)
+        return TINF_DATA_ERROR;
+      if (dest && ((uint32_t)xxh64(z->base, z->op - z->base, 0) != zstd_le32(ip)))
+        return TINF_DATA_ERROR;
+      ip += 4;
+    }
+
+    if (dest) {
+      if ((content != ~0ULL) && (content != (uint64_t)(z->op - z->base)))
+        return TINF_DATA_ERROR;
+      total += z->op - z->base;
+      op = z->op;
+    }
+  }
+
+  if (total >> 32)
+    return TINF_DATA_ERROR;
+
+  *destLen = total;
+  return TINF_OK;
+}
+
+/* EOF */